@@ -139,6 +139,56 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
   block->write_cnt++;
 }
 
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK,
+   the I'th one into BUFFERS[I], each of which must have room for
+   BLOCK_SECTOR_SIZE bytes.  Drivers that support it do this with
+   a single request.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multi (struct block *block, block_sector_t sector, size_t cnt,
+                  void *const buffers[])
+{
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  if (block->ops->read_multi != NULL)
+    block->ops->read_multi (block->aux, sector, cnt, buffers);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->read (block->aux, sector + i, buffers[i]);
+  block->read_cnt += cnt;
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK, the
+   I'th one from BUFFERS[I], each of which must contain
+   BLOCK_SECTOR_SIZE bytes.  Drivers that support it do this with
+   a single request.  Returns after the block device has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multi (struct block *block, block_sector_t sector, size_t cnt,
+                   void *const buffers[])
+{
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  if (block->ops->write_multi != NULL)
+    block->ops->write_multi (block->aux, sector, cnt, buffers);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->write (block->aux, sector + i, buffers[i]);
+  block->write_cnt += cnt;
+}
+
 /* Returns the number of sectors in BLOCK. */
 block_sector_t
 block_size (struct block *block)
@@ -160,6 +210,14 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Returns the number of sectors read from and written to BLOCK
+   so far. */
+unsigned long long
+block_io_cnt (struct block *block)
+{
+  return block->read_cnt + block->write_cnt;
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
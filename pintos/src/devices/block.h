@@ -53,10 +53,15 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multi (struct block *, block_sector_t, size_t cnt,
+                       void *const buffers[]);
+void block_write_multi (struct block *, block_sector_t, size_t cnt,
+                        void *const buffers[]);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
 /* Statistics. */
+unsigned long long block_io_cnt (struct block *);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
@@ -65,6 +70,15 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors, the I'th one
+       to or from BUFFERS[I], in as few requests as the device
+       allows.  Drivers that leave these null get one read() or
+       write() call per sector. */
+    void (*read_multi) (void *aux, block_sector_t, size_t cnt,
+                        void *const buffers[]);
+    void (*write_multi) (void *aux, block_sector_t, size_t cnt,
+                         void *const buffers[]);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -0,0 +1,27 @@
+/* cachestat.c
+
+   Prints the kernel's buffer cache statistics. */
+
+#include <syscall.h>
+#include <stdio.h>
+
+int
+main (void) 
+{
+  struct cache_stats s;
+
+  if (!cache_stats (&s))
+    {
+      printf ("cachestat: cannot read cache statistics\n");
+      return EXIT_FAILURE;
+    }
+  printf ("hits:             %llu\n", s.hits);
+  printf ("misses:           %llu\n", s.misses);
+  printf ("evictions:        %llu\n", s.evictions);
+  printf ("writebacks:       %llu\n", s.writebacks);
+  printf ("read-ahead reads: %llu\n", s.ra_reads);
+  printf ("read-ahead hits:  %llu\n", s.ra_hits);
+  printf ("lock waits:       %llu (%llu ticks)\n",
+          s.lock_waits, s.lock_wait_ticks);
+  return EXIT_SUCCESS;
+}
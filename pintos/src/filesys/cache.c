@@ -1,102 +1,800 @@
-/* 
+/*
   Thanks Yuxuan Chen for helping us understand the algorithm.
 */
 
 #include <lib/stdbool.h>
 #include <lib/stdio.h>
+#include <lib/stdlib.h>
 #include <lib/string.h>
+#include <hash.h>
 #include <threads/synch.h>
+#include <threads/thread.h>
 #include <devices/timer.h>
 #include "cache.h"
 #include "filesys.h"
+#include "lib/user/syscall.h"
 
+/* Number of cached sectors.  Lookups go through a hash index, so
+   raising this only costs memory. */
 #define CACHE_SIZE 64
 
+/* Write-behind tuning.  The flusher wakes every FLUSH_INTERVAL
+   ticks and writes back blocks that have been dirty for at least
+   FLUSH_AGE ticks, or every dirty block once more than DIRTY_HIGH
+   of them have piled up. */
+#define FLUSH_INTERVAL (TIMER_FREQ / 10)
+#define FLUSH_AGE TIMER_FREQ
+#define DIRTY_HIGH (CACHE_SIZE / 2)
+
+/* Maximum number of pending read-ahead requests.  Requests beyond
+   this are dropped; read-ahead is only a hint. */
+#define RA_QUEUE_SIZE 32
+
+/* Most sectors read or written back with one device request.
+   Kept well below CACHE_SIZE so a run never ties up the cache. */
+#define RUN_MAX (CACHE_SIZE / 4)
+
+/* 2Q queue sizes: at most A1IN_SIZE blocks stay in the FIFO of
+   blocks seen once, and the sectors of the last GHOST_SIZE blocks
+   evicted from it are remembered. */
+#define A1IN_SIZE (CACHE_SIZE / 4)
+#define GHOST_SIZE (CACHE_SIZE / 2)
+
+/* cache_lock protects every member except BUFFER, whose contents
+   are guarded by RW.  Disk I/O is done without cache_lock held:
+   LOADING or FLUSHING is set instead, which keeps the block from
+   being evicted, and waiters sleep on cache_changed. */
 struct cache_block {
-  unsigned char buffer[BLOCK_SECTOR_SIZE];
+  unsigned char *buffer;              /* Points into cache_data. */
   block_sector_t sector_index;
+  struct hash_elem elem;              /* Element in cache_index. */
+  struct list_elem queue_elem;        /* Element in cache_free or a 2Q queue. */
+  struct list *queue;                 /* 2Q queue holding the block. */
+  struct rwlock rw;                   /* Held between cache_get and cache_put. */
   bool used;
   bool recent;
   bool dirty;
+  bool loading;                       /* Being read from disk. */
+  bool flushing;                      /* Being written back to disk. */
+  bool prefetched;                    /* Read ahead and not yet used. */
+  bool held;                          /* In the running log transaction,
+                                         so not written back. */
+  int pin_cnt;                        /* Outstanding cache_get()s. */
+  int64_t dirty_since;                /* Tick of the first unflushed write. */
 };
 
 static struct cache_block caches[CACHE_SIZE];
+static unsigned char cache_data[CACHE_SIZE][BLOCK_SECTOR_SIZE];
+static struct hash cache_index;       /* Used blocks, keyed by sector. */
 static struct lock cache_lock;
+static struct condition cache_changed; /* A pin dropped to 0 or I/O finished. */
+static struct list cache_free;        /* Unused slots. */
+static struct cache_stats stats;      /* Protected by cache_lock. */
+
+/* Replacement policy.  All hooks are called with cache_lock held. */
+struct cache_policy
+  {
+    void (*insert) (int);             /* Slot now caches a new sector. */
+    void (*touch) (int);              /* Slot was hit. */
+    int (*victim) (void);             /* Returns an evictable slot or -1. */
+    void (*remove) (int);             /* Slot's sector is being evicted. */
+  };
+
+enum cache_replacement cache_replacement = CACHE_CLOCK;
+static const struct cache_policy *policy;
+
+/* 2Q state. */
+struct ghost
+  {
+    block_sector_t sector;
+    bool in_use;
+    struct hash_elem elem;            /* Element in ghost_index. */
+  };
+
+static struct list a1in, am;          /* Seen once (FIFO), seen again (LRU). */
+static size_t a1in_cnt;
+static struct ghost ghosts[GHOST_SIZE]; /* Recently evicted from A1in. */
+static int ghost_next;
+static struct hash ghost_index;
+
+int used_cnt = 0, current_cache = 0, dirty_cnt = 0;
+
+/* Slots picked by the flusher, sorted by sector.  Owned by the
+   flusher thread. */
+static int flush_order[CACHE_SIZE];
 
-int used_cnt = 0, current_cache = 0;
+/* Read-ahead requests, consumed by the cache_reader thread. */
+struct ra_request
+  {
+    block_sector_t sector;            /* First sector. */
+    size_t cnt;                       /* Number of sectors. */
+  };
+static struct ra_request ra_queue[RA_QUEUE_SIZE];
+static unsigned ra_head, ra_tail;
+static struct lock ra_lock;
+static struct semaphore ra_sema;      /* Number of queued requests. */
 
 #define next_cache(x) (((x) + 1) % CACHE_SIZE)
-#define read_fs(cache) (block_read (fs_device, sector, cache.buffer))
-#define write_fs(cache) (block_write (fs_device, cache.sector_index, cache.buffer))
-#define occupy_cache(cache, sector) do {used_cnt ++; \
-                                cache.used = true; \
-                                cache.sector_index = sector; } while (false)
-static int cache_get_free (void);
+#define write_fs(cache) (block_write (fs_device, (cache).sector_index, (cache).buffer))
+#define cache_busy(cache) ((cache).pin_cnt > 0 || (cache).loading || (cache).flushing || (cache).held)
+#define occupy_cache(i, sector) do {used_cnt ++; \
+                                caches[i].used = true; \
+                                caches[i].sector_index = sector; \
+                                hash_insert (&cache_index, &caches[i].elem); \
+                                policy->insert (i); } while (false)
+#define release_cache(i) list_push_back (&cache_free, &caches[i].queue_elem)
+static int cache_get_free (bool wait);
+static int cache_lookup (block_sector_t);
+static void cache_load (int);
+static void cache_load_run (block_sector_t, size_t cnt, bool prefetch);
+static void cache_writeback (int);
+static void cache_writeback_run (const int *slots, size_t cnt);
+static void cache_flush (bool all);
+static void cache_lock_acquire (void);
+static thread_func cache_flusher;
+static thread_func cache_reader;
+static hash_hash_func cache_hash;
+static hash_less_func cache_less;
+static hash_hash_func ghost_hash;
+static hash_less_func ghost_less;
 
+/* Acquires cache_lock, accounting for the time spent waiting. */
+static void
+cache_lock_acquire (void) {
+  int64_t start;
+  if (cache_lock.holder == NULL) {
+    lock_acquire (&cache_lock);
+    return;
+  }
+  start = timer_ticks ();
+  lock_acquire (&cache_lock);
+  stats.lock_waits ++;
+  stats.lock_wait_ticks += timer_elapsed (start);
+}
+
+static unsigned
+cache_hash (const struct hash_elem *e, void *aux UNUSED) {
+  return hash_int (hash_entry (e, struct cache_block, elem)->sector_index);
+}
+
+static bool
+cache_less (const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED) {
+  return hash_entry (a, struct cache_block, elem)->sector_index
+       < hash_entry (b, struct cache_block, elem)->sector_index;
+}
+
+/* Returns the slot holding SECTOR, or -1 if it is not cached. */
 static int
-cache_get_free () { // only called by locked func
-  current_cache = next_cache(current_cache);
-  while (caches[current_cache].used && caches[current_cache].recent) {
-    caches[current_cache].recent = false;
-    current_cache = next_cache(current_cache);
-  }
-  if (caches[current_cache].used) {
-    if (caches[current_cache].dirty) {
-      write_fs(caches[current_cache]);
-      caches[current_cache].dirty = false;
+cache_lookup (block_sector_t sector) { // only called by locked func
+  struct cache_block key;
+  struct hash_elem *e;
+  key.sector_index = sector;
+  e = hash_find (&cache_index, &key.elem);
+  return e != NULL ? hash_entry (e, struct cache_block, elem) - caches : -1;
+}
+
+/* Reads the sectors of the CNT slots in SLOTS, which hold
+   consecutive sectors in order, from disk with one request.
+   Drops cache_lock during the read; anyone else finding the blocks
+   waits until they are loaded. */
+static void
+cache_load_slots (const int *slots, size_t cnt) { // only called by locked func
+  void *bufs[RUN_MAX];
+  size_t k;
+  ASSERT (cnt > 0 && cnt <= RUN_MAX);
+  for (k = 0; k < cnt; ++k) {
+    caches[slots[k]].loading = true;
+    bufs[k] = caches[slots[k]].buffer;
+  }
+  lock_release (&cache_lock);
+  block_read_multi (fs_device, caches[slots[0]].sector_index, cnt, bufs);
+  cache_lock_acquire ();
+  for (k = 0; k < cnt; ++k)
+    caches[slots[k]].loading = false;
+  cond_broadcast (&cache_changed, &cache_lock);
+}
+
+/* Reads slot I's sector from disk.  Drops cache_lock during the
+   read; anyone else finding the block waits until it is loaded. */
+static void
+cache_load (int i) { // only called by locked func
+  cache_load_slots (&i, 1);
+}
+
+/* Brings the CNT sectors starting at SECTOR into the cache without
+   pinning them, reading each run of uncached sectors with a single
+   request.  Marks the blocks as read ahead if PREFETCH. */
+static void
+cache_load_run (block_sector_t sector, size_t cnt, bool prefetch) { // only called by locked func
+  int slots[RUN_MAX];
+  size_t n;
+  int i;
+
+  while (cnt > 0) {
+    /* Claim slots for the uncached sectors at the front.  Only the
+       first claim may wait for a slot: waiting while holding
+       claimed slots could tie up the whole cache. */
+    for (n = 0; n < cnt && n < RUN_MAX; ++n) {
+      if (cache_lookup (sector + n) >= 0)
+        break;
+      i = cache_get_free (n == 0);
+      if (i < 0)
+        break;
+      if (cache_lookup (sector + n) >= 0) {
+        release_cache(i);
+        break;
+      }
+      occupy_cache(i, sector + n);
+      caches[i].prefetched = prefetch;
+      caches[i].held = false;
+      caches[i].loading = true;
+      slots[n] = i;
     }
-    caches[current_cache].used = false;
+    if (n > 0) {
+      if (prefetch)
+        stats.ra_reads += n;
+      cache_load_slots (slots, n);
+    } else
+      n = 1;
+    sector += n;
+    cnt -= n;
+  }
+}
+
+/* Writes the dirty slots in SLOTS, which hold CNT consecutive
+   sectors in order, back to disk with one request.  Drops
+   cache_lock during the write.  Readers may keep using the blocks
+   meanwhile; writers wait on their rwlocks, and their changes mark
+   the blocks dirty again.  Only a run of one block may include a
+   pinned block, since waiting for its rwlock while holding others
+   could deadlock.  If that block joins the log transaction in the
+   meantime, it is left dirty and not written. */
+static void
+cache_writeback_run (const int *slots, size_t cnt) { // only called by locked func
+  void *bufs[RUN_MAX];
+  bool pinned = false, skip = false;
+  size_t k;
+  ASSERT (cnt > 0 && cnt <= RUN_MAX);
+  for (k = 0; k < cnt; ++k) {
+    struct cache_block *b = &caches[slots[k]];
+    ASSERT (b->dirty && !b->loading && !b->flushing);
+    b->flushing = true;
+    b->dirty = false;
+    dirty_cnt --;
+    bufs[k] = b->buffer;
+    pinned = pinned || b->pin_cnt > 0;
+  }
+  ASSERT (cnt == 1 || !pinned);
+  /* Nobody holds the rwlock of an unpinned block, so these do not
+     block. */
+  if (!pinned)
+    for (k = 0; k < cnt; ++k)
+      rwlock_acquire_read (&caches[slots[k]].rw);
+  lock_release (&cache_lock);
+  if (pinned) {
+    /* Holding the block for the log takes its write lock, so once
+       we have the read lock HELD cannot change until we are done. */
+    rwlock_acquire_read (&caches[slots[0]].rw);
+    cache_lock_acquire ();
+    skip = caches[slots[0]].held;
+    lock_release (&cache_lock);
+  }
+  if (!skip)
+    block_write_multi (fs_device, caches[slots[0]].sector_index, cnt, bufs);
+  for (k = 0; k < cnt; ++k)
+    rwlock_release_read (&caches[slots[k]].rw);
+  cache_lock_acquire ();
+  if (skip) {
+    struct cache_block *b = &caches[slots[0]];
+    if (!b->dirty) {
+      b->dirty = true;
+      b->dirty_since = timer_ticks ();
+      dirty_cnt ++;
+    }
+  } else
+    stats.writebacks += cnt;
+  for (k = 0; k < cnt; ++k)
+    caches[slots[k]].flushing = false;
+  cond_broadcast (&cache_changed, &cache_lock);
+}
+
+/* Writes dirty slot I back to disk.  Drops cache_lock during the
+   write. */
+static void
+cache_writeback (int i) { // only called by locked func
+  cache_writeback_run (&i, 1);
+}
+
+/* Returns an unused slot, evicting the block chosen by the
+   replacement policy if needed.  If every block is busy, waits
+   for one to become free if WAIT, otherwise returns -1.  May drop
+   cache_lock to write back a dirty victim, so callers must look
+   their sector up again afterwards and hand the slot back with
+   release_cache() if it is no longer needed. */
+static int
+cache_get_free (bool wait) { // only called by locked func
+  for (;;) {
+    int c;
+    if (!list_empty (&cache_free))
+      return list_entry (list_pop_front (&cache_free),
+                         struct cache_block, queue_elem) - caches;
+    c = policy->victim ();
+    if (c < 0 && !wait)
+      return -1;
+    if (c < 0) {
+      cond_wait (&cache_changed, &cache_lock);
+      continue;
+    }
+    if (caches[c].dirty) {
+      cache_writeback (c);
+      /* It may have been pinned or dirtied while unlocked. */
+      if (cache_busy(caches[c]) || caches[c].dirty)
+        continue;
+    }
+    policy->remove (c);
+    stats.evictions ++;
+    hash_delete (&cache_index, &caches[c].elem);
+    caches[c].used = false;
     used_cnt --;
+    return c;
+  }
+}
+
+/* Clock: a block gets a second chance if it was used since the
+   hand last passed it. */
+
+static void
+clock_touch (int i) {
+  caches[i].recent = true;
+}
+
+static int
+clock_victim (void) {
+  int i, c;
+  /* Two sweeps are enough to clear every recent bit. */
+  for (i = 0; i < 2 * CACHE_SIZE; ++i) {
+    c = current_cache = next_cache(current_cache);
+    if (!caches[c].used || cache_busy(caches[c]))
+      continue;
+    if (caches[c].recent) {
+      caches[c].recent = false;
+      continue;
+    }
+    return c;
+  }
+  return -1;
+}
+
+static void
+clock_remove (int i UNUSED) {
+}
+
+static const struct cache_policy clock_policy =
+  {
+    clock_touch,
+    clock_touch,
+    clock_victim,
+    clock_remove
+  };
+
+/* 2Q: a block seen once goes to the A1in FIFO, so a large scan
+   only churns A1in.  Only blocks referenced again after leaving
+   A1in, which the ghost list detects, are promoted to the Am LRU
+   where hot metadata lives. */
+
+static unsigned
+ghost_hash (const struct hash_elem *e, void *aux UNUSED) {
+  return hash_int (hash_entry (e, struct ghost, elem)->sector);
+}
+
+static bool
+ghost_less (const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED) {
+  return hash_entry (a, struct ghost, elem)->sector
+       < hash_entry (b, struct ghost, elem)->sector;
+}
+
+/* Forgets SECTOR if it is on the ghost list.  Returns true if it
+   was. */
+static bool
+ghost_take (block_sector_t sector) {
+  struct ghost key;
+  struct hash_elem *e;
+  key.sector = sector;
+  e = hash_delete (&ghost_index, &key.elem);
+  if (e == NULL)
+    return false;
+  hash_entry (e, struct ghost, elem)->in_use = false;
+  return true;
+}
+
+/* Remembers SECTOR, replacing the oldest ghost. */
+static void
+ghost_add (block_sector_t sector) {
+  struct ghost *g = &ghosts[ghost_next];
+  ghost_next = (ghost_next + 1) % GHOST_SIZE;
+  if (g->in_use)
+    hash_delete (&ghost_index, &g->elem);
+  g->sector = sector;
+  g->in_use = true;
+  hash_insert (&ghost_index, &g->elem);
+}
+
+static void
+twoq_insert (int i) {
+  if (ghost_take (caches[i].sector_index)) {
+    caches[i].queue = &am;
+    list_push_front (&am, &caches[i].queue_elem);
+  } else {
+    caches[i].queue = &a1in;
+    list_push_back (&a1in, &caches[i].queue_elem);
+    a1in_cnt ++;
+  }
+}
+
+static void
+twoq_touch (int i) {
+  if (caches[i].queue == &am) {
+    list_remove (&caches[i].queue_elem);
+    list_push_front (&am, &caches[i].queue_elem);
+  }
+}
+
+/* Returns the first evictable slot in QUEUE, scanning from its
+   back if BACKWARD, or -1. */
+static int
+twoq_scan (struct list *queue, bool backward) {
+  struct list_elem *e;
+  if (backward) {
+    for (e = list_rbegin (queue); e != list_rend (queue); e = list_prev (e))
+      if (!cache_busy(*list_entry (e, struct cache_block, queue_elem)))
+        return list_entry (e, struct cache_block, queue_elem) - caches;
+  } else {
+    for (e = list_begin (queue); e != list_end (queue); e = list_next (e))
+      if (!cache_busy(*list_entry (e, struct cache_block, queue_elem)))
+        return list_entry (e, struct cache_block, queue_elem) - caches;
+  }
+  return -1;
+}
+
+static int
+twoq_victim (void) {
+  int c;
+  if (a1in_cnt > A1IN_SIZE && (c = twoq_scan (&a1in, false)) >= 0)
+    return c;
+  if ((c = twoq_scan (&am, true)) >= 0)
+    return c;
+  return twoq_scan (&a1in, false);
+}
+
+static void
+twoq_remove (int i) {
+  list_remove (&caches[i].queue_elem);
+  if (caches[i].queue == &a1in) {
+    a1in_cnt --;
+    ghost_add (caches[i].sector_index);
   }
-  return current_cache;
+  caches[i].queue = NULL;
 }
 
+static const struct cache_policy twoq_policy =
+  {
+    twoq_insert,
+    twoq_touch,
+    twoq_victim,
+    twoq_remove
+  };
+
 void
 cache_init () {
+  int i;
   lock_init (&cache_lock);
+  cond_init (&cache_changed);
   used_cnt = 0;
   current_cache = -1;
   memset(caches, 0, sizeof caches);
+  memset (&stats, 0, sizeof stats);
+  list_init (&cache_free);
+  for (i = 0; i < CACHE_SIZE; ++i) {
+    caches[i].buffer = cache_data[i];
+    rwlock_init (&caches[i].rw);
+    release_cache(i);
+  }
+  if (!hash_init (&cache_index, cache_hash, cache_less, NULL))
+    PANIC ("cache index creation failed");
+
+  list_init (&a1in);
+  list_init (&am);
+  a1in_cnt = 0;
+  memset (ghosts, 0, sizeof ghosts);
+  ghost_next = 0;
+  if (!hash_init (&ghost_index, ghost_hash, ghost_less, NULL))
+    PANIC ("cache ghost index creation failed");
+  policy = cache_replacement == CACHE_2Q ? &twoq_policy : &clock_policy;
+  lock_init (&ra_lock);
+  sema_init (&ra_sema, 0);
+  ra_head = ra_tail = 0;
+  thread_create ("cache_flusher", PRI_DEFAULT, cache_flusher, NULL);
+  thread_create ("cache_reader", PRI_DEFAULT, cache_reader, NULL);
 }
 
-void
-cache_read (block_sector_t sector, void *buffer) {
-  lock_acquire (&cache_lock);
+/* Returns a pointer to the cached contents of SECTOR, reading it
+   from disk first unless MODE is CACHE_ZERO, in which case the
+   block is zero-filled instead.  The block stays pinned in the
+   cache until the caller passes the pointer to cache_put().
+   CACHE_READ holds the block shared with other readers;
+   CACHE_WRITE and CACHE_ZERO hold it exclusively and mark it
+   dirty, so the caller may modify it in place.  A thread must not
+   get a block it already holds. */
+void *
+cache_get (block_sector_t sector, enum cache_mode mode) {
+  bool hit = true, zeroing;
   int i;
-  for (i = 0; i < CACHE_SIZE; ++i)
-    if (caches[i].used && caches[i].sector_index == sector)
+  cache_lock_acquire ();
+  for (;;) {
+    i = cache_lookup (sector);
+    if (i >= 0)
       break;
-  if (i == CACHE_SIZE) {
-    i = cache_get_free ();
-    occupy_cache(caches[i], sector);
-    read_fs(caches[i]);
+    i = cache_get_free (true);
+    if (cache_lookup (sector) < 0) {
+      occupy_cache(i, sector);
+      caches[i].prefetched = false;
+      caches[i].held = false;
+      hit = false;
+      break;
+    }
+    release_cache(i);
   }
-  caches[i].recent = true;
-  memcpy (buffer, caches[i].buffer, BLOCK_SECTOR_SIZE);
+  caches[i].pin_cnt ++;
+  if (hit) {
+    stats.hits ++;
+    if (caches[i].prefetched) {
+      caches[i].prefetched = false;
+      stats.ra_hits ++;
+    }
+  } else
+    stats.misses ++;
+  /* A block zeroed instead of read still holds whatever sector the
+     slot had last.  It counts as loading until zeroed under the
+     write lock below, so that nobody else can get at it first. */
+  zeroing = !hit && mode == CACHE_ZERO;
+  if (zeroing)
+    caches[i].loading = true;
+  else if (!hit)
+    cache_load (i);
+  while (caches[i].loading && !zeroing)
+    cond_wait (&cache_changed, &cache_lock);
+  if (mode != CACHE_READ && !caches[i].dirty) {
+    caches[i].dirty = true;
+    caches[i].dirty_since = timer_ticks ();
+    dirty_cnt ++;
+  }
+  if (hit)
+    policy->touch (i);
   lock_release (&cache_lock);
+
+  if (mode == CACHE_READ)
+    rwlock_acquire_read (&caches[i].rw);
+  else {
+    rwlock_acquire_write (&caches[i].rw);
+    if (mode == CACHE_ZERO)
+      memset (caches[i].buffer, 0, BLOCK_SECTOR_SIZE);
+    if (zeroing) {
+      cache_lock_acquire ();
+      caches[i].loading = false;
+      cond_broadcast (&cache_changed, &cache_lock);
+      lock_release (&cache_lock);
+    }
+  }
+  return caches[i].buffer;
+}
+
+/* Releases and unpins BLOCK, a pointer returned by cache_get(). */
+void
+cache_put (const void *block) {
+  int i = ((const unsigned char *) block - cache_data[0]) / BLOCK_SECTOR_SIZE;
+  ASSERT (i >= 0 && i < CACHE_SIZE);
+  if (rwlock_write_held_by_current_thread (&caches[i].rw))
+    rwlock_release_write (&caches[i].rw);
+  else
+    rwlock_release_read (&caches[i].rw);
+  cache_lock_acquire ();
+  ASSERT (caches[i].pin_cnt > 0);
+  if (--caches[i].pin_cnt == 0)
+    cond_broadcast (&cache_changed, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+void
+cache_read (block_sector_t sector, void *buffer) {
+  void *block = cache_get (sector, CACHE_READ);
+  memcpy (buffer, block, BLOCK_SECTOR_SIZE);
+  cache_put (block);
 }
 
 void
 cache_write (block_sector_t sector, const void *buffer) {
-  lock_acquire (&cache_lock);
+  void *block = cache_get (sector, CACHE_ZERO);
+  memcpy (block, buffer, BLOCK_SECTOR_SIZE);
+  cache_put (block);
+}
+
+/* Brings the CNT sectors starting at SECTOR into the cache, reading
+   consecutive uncached sectors with one device request, so that
+   later cache_get() calls for them hit. */
+void
+cache_fetch (block_sector_t sector, size_t cnt) {
+  cache_lock_acquire ();
+  cache_load_run (sector, cnt, false);
+  lock_release (&cache_lock);
+}
+
+/* Asks the cache_reader thread to bring the CNT sectors starting
+   at SECTOR into the cache without waiting for them. */
+void
+cache_readahead (block_sector_t sector, size_t cnt) {
+  lock_acquire (&ra_lock);
+  if (ra_tail - ra_head < RA_QUEUE_SIZE) {
+    ra_queue[ra_tail % RA_QUEUE_SIZE].sector = sector;
+    ra_queue[ra_tail % RA_QUEUE_SIZE].cnt = cnt;
+    ra_tail++;
+    sema_up (&ra_sema);
+  }
+  lock_release (&ra_lock);
+}
+
+/* Keeps BLOCK, a pointer returned by cache_get() and not yet
+   passed to cache_put(), from being written back or evicted until
+   cache_unhold() is called for its sector, which is returned. */
+block_sector_t
+cache_hold (const void *block) {
+  int i = ((const unsigned char *) block - cache_data[0]) / BLOCK_SECTOR_SIZE;
+  ASSERT (i >= 0 && i < CACHE_SIZE);
+  ASSERT (caches[i].pin_cnt > 0);
+  cache_lock_acquire ();
+  caches[i].held = true;
+  lock_release (&cache_lock);
+  return caches[i].sector_index;
+}
+
+/* Lets SECTOR, held by cache_hold(), be written back again. */
+void
+cache_unhold (block_sector_t sector) {
   int i;
-  for (i = 0; i < CACHE_SIZE; ++i)
-    if (caches[i].used && caches[i].sector_index == sector) 
-      break;
-  if (i == CACHE_SIZE) {
-    i = cache_get_free ();
-    occupy_cache(caches[i], sector);
+  cache_lock_acquire ();
+  i = cache_lookup (sector);
+  ASSERT (i >= 0);
+  caches[i].held = false;
+  cond_broadcast (&cache_changed, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Writes SECTOR back to disk now if it is cached and dirty.  It
+   must not be held. */
+void
+cache_sync (block_sector_t sector) {
+  int i;
+  cache_lock_acquire ();
+  while ((i = cache_lookup (sector)) >= 0
+         && (caches[i].dirty || caches[i].flushing)) {
+    ASSERT (!caches[i].held);
+    if (caches[i].flushing || caches[i].loading)
+      cond_wait (&cache_changed, &cache_lock);
+    else
+      cache_writeback (i);
   }
-  caches[i].dirty = true;
-  caches[i].recent = true;
-  memcpy (caches[i].buffer, buffer, BLOCK_SECTOR_SIZE);
   lock_release (&cache_lock);
 }
 
 void
 cache_done () {
   int i;
+  bool locked = lock_held_by_current_thread (&cache_lock);
+  if (!locked)
+    cache_lock_acquire ();
   for (i = 0; i < CACHE_SIZE; ++i)
-    if (caches[i].used && caches[i].dirty)
+    if (caches[i].used && caches[i].dirty) {
       write_fs (caches[i]);
-}
\ No newline at end of file
+      caches[i].dirty = false;
+      dirty_cnt --;
+      stats.writebacks ++;
+    }
+  if (!locked)
+    lock_release (&cache_lock);
+}
+
+/* Copies the cache counters into *S. */
+void
+cache_get_stats (struct cache_stats *s) {
+  cache_lock_acquire ();
+  *s = stats;
+  lock_release (&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void) {
+  printf ("Cache: %llu hits, %llu misses, %llu evictions, %llu writebacks\n",
+          stats.hits, stats.misses, stats.evictions, stats.writebacks);
+  printf ("Cache: %llu read-ahead reads, %llu read-ahead hits\n",
+          stats.ra_reads, stats.ra_hits);
+  printf ("Cache: %llu lock waits, %llu ticks waiting\n",
+          stats.lock_waits, stats.lock_wait_ticks);
+}
+
+static int
+flush_order_cmp (const void *a, const void *b) {
+  block_sector_t x = caches[*(const int *) a].sector_index;
+  block_sector_t y = caches[*(const int *) b].sector_index;
+  return x < y ? -1 : x > y;
+}
+
+/* Writes back dirty blocks in ascending sector order: every dirty
+   block if ALL, otherwise only those older than FLUSH_AGE. */
+static void
+cache_flush (bool all) {
+  int i, n, cnt = 0;
+  cache_lock_acquire ();
+  for (i = 0; i < CACHE_SIZE; ++i)
+    if (caches[i].used && caches[i].dirty && !caches[i].held
+        && (all || timer_elapsed (caches[i].dirty_since) >= FLUSH_AGE))
+      flush_order[cnt++] = i;
+  qsort (flush_order, cnt, sizeof *flush_order, flush_order_cmp);
+  lock_release (&cache_lock);
+
+  /* Write back runs of consecutive sectors with one request each.
+     A pinned block goes alone; see cache_writeback_run(). */
+  for (i = 0; i < cnt; i += n) {
+    int run[RUN_MAX];
+    struct cache_block *b;
+    int k;
+    n = 0;
+    cache_lock_acquire ();
+    for (k = i; k < cnt && n < RUN_MAX; ++k) {
+      b = &caches[flush_order[k]];
+      /* The slot may have been written back or reused meanwhile. */
+      if (!b->used || !b->dirty || b->loading || b->flushing || b->held)
+        break;
+      if (n > 0 && (b->pin_cnt > 0 || caches[run[0]].pin_cnt > 0
+                    || b->sector_index != caches[run[0]].sector_index + n))
+        break;
+      run[n++] = flush_order[k];
+    }
+    if (n > 0)
+      cache_writeback_run (run, n);
+    else
+      n = 1;
+    lock_release (&cache_lock);
+  }
+}
+
+/* Write-behind thread. */
+static void
+cache_flusher (void *aux UNUSED) {
+  int64_t last = timer_ticks ();
+  for (;;) {
+    timer_sleep (FLUSH_INTERVAL);
+    if (dirty_cnt > DIRTY_HIGH)
+      cache_flush (true);
+    else if (timer_elapsed (last) >= FLUSH_AGE) {
+      cache_flush (false);
+      last = timer_ticks ();
+    }
+  }
+}
+
+/* Read-ahead thread. */
+static void
+cache_reader (void *aux UNUSED) {
+  for (;;) {
+    struct ra_request r;
+
+    sema_down (&ra_sema);
+    lock_acquire (&ra_lock);
+    r = ra_queue[ra_head++ % RA_QUEUE_SIZE];
+    lock_release (&ra_lock);
+
+    cache_lock_acquire ();
+    cache_load_run (r.sector, r.cnt, true);
+    lock_release (&cache_lock);
+  }
+}
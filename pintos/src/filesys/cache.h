@@ -3,9 +3,38 @@
 
 #include "devices/block.h"
 
+/* How a block obtained with cache_get() will be used. */
+enum cache_mode
+  {
+    CACHE_READ,                 /* Read only. */
+    CACHE_WRITE,                /* Modified in place. */
+    CACHE_ZERO                  /* Zero-filled, then modified in place. */
+  };
+
+/* Buffer cache replacement policies, chosen with the "-cache"
+   kernel command-line option. */
+enum cache_replacement
+  {
+    CACHE_CLOCK,                /* Second-chance clock. */
+    CACHE_2Q                    /* Scan-resistant 2Q. */
+  };
+
+extern enum cache_replacement cache_replacement;
+
 void cache_init (void);
+void *cache_get (block_sector_t sector, enum cache_mode mode);
+void cache_put (const void *block);
 void cache_read (block_sector_t sector, void *buffer);
 void cache_write (block_sector_t sector, const void *buffer);
+void cache_fetch (block_sector_t sector, size_t cnt);
+void cache_readahead (block_sector_t sector, size_t cnt);
+block_sector_t cache_hold (const void *block);
+void cache_unhold (block_sector_t sector);
+void cache_sync (block_sector_t sector);
 void cache_done (void);
 
+struct cache_stats;
+void cache_get_stats (struct cache_stats *);
+void cache_print_stats (void);
+
 #endif
@@ -0,0 +1,163 @@
+/* Online defragmenter.
+
+   A thread at the lowest priority walks the directory tree one
+   file at a time and has inode_defrag() move each file whose data
+   is spread over several runs of sectors into a single run.  It
+   only works while the disk is otherwise quiet: before each step
+   it checks how many sectors were transferred since its last one,
+   and backs off, waiting twice as long each time, while other I/O
+   goes on.  It rests before each pass, the first one included, so
+   a short-lived system never sees it. */
+
+#include "filesys/defrag.h"
+#include <debug.h>
+#include <list.h>
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "filesys/directory.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Ticks between steps while the disk is idle, at most between
+   steps while it is busy, and between passes. */
+#define DEFRAG_INTERVAL (TIMER_FREQ / 10)
+#define DEFRAG_BACKOFF_MAX (TIMER_FREQ * 10)
+#define DEFRAG_PASS_INTERVAL (TIMER_FREQ * 60)
+
+/* Most sectors transferred by others between two steps for the
+   disk to count as idle.  Leaves room for the write-behind
+   threads. */
+#define IDLE_IO 16
+
+/* A directory waiting to be walked. */
+struct pending_dir
+  {
+    struct list_elem elem;              /* Element in pending. */
+    block_sector_t sector;              /* Its inode sector. */
+  };
+
+static struct list pending;             /* Directories left in this pass. */
+static struct dir *cur;                 /* Directory being walked, or null. */
+static bool stopping;                   /* Set by defrag_done(). */
+static struct lock defrag_lock;         /* Held during a step; guards
+                                           all of the above. */
+
+static thread_func defrag_thread;
+
+/* Starts the defragmenter. */
+void
+defrag_init (void)
+{
+  list_init (&pending);
+  cur = NULL;
+  stopping = false;
+  lock_init (&defrag_lock);
+  thread_create ("defrag", PRI_MIN, defrag_thread, NULL);
+}
+
+/* Adds the directory at SECTOR to the directories left to walk. */
+static void
+push_dir (block_sector_t sector)
+{
+  struct pending_dir *p = malloc (sizeof *p);
+
+  if (p != NULL)
+    {
+      p->sector = sector;
+      list_push_back (&pending, &p->elem);
+    }
+}
+
+/* Defragments the next file of the pass.  Returns false if the
+   pass is over. */
+static bool
+defrag_step (void)
+{
+  char name[NAME_MAX + 1];
+  struct inode *inode;
+
+  for (;;)
+    {
+      if (cur == NULL)
+        {
+          struct pending_dir *p;
+
+          if (list_empty (&pending))
+            return false;
+          p = list_entry (list_pop_front (&pending), struct pending_dir, elem);
+          cur = dir_open (inode_open (p->sector));
+          free (p);
+          continue;
+        }
+      if (!dir_readdir (cur, name))
+        {
+          dir_close (cur);
+          cur = NULL;
+          continue;
+        }
+      if (!dir_lookup (cur, name, &inode) || inode == NULL)
+        continue;
+
+      if (inode_is_dir (inode))
+        push_dir (inode_get_inumber (inode));
+      inode_defrag (inode);
+      inode_close (inode);
+      return true;
+    }
+}
+
+/* Defragmenter thread. */
+static void
+defrag_thread (void *aux UNUSED)
+{
+  int64_t delay = DEFRAG_INTERVAL;
+  unsigned long long last = block_io_cnt (fs_device);
+
+  for (;;)
+    {
+      timer_sleep (delay);
+
+      /* Stay out of the way of other I/O. */
+      if (block_io_cnt (fs_device) - last > IDLE_IO)
+        {
+          last = block_io_cnt (fs_device);
+          delay = delay * 2 < DEFRAG_BACKOFF_MAX ? delay * 2
+                                                 : DEFRAG_BACKOFF_MAX;
+          continue;
+        }
+
+      lock_acquire (&defrag_lock);
+      if (stopping)
+        {
+          lock_release (&defrag_lock);
+          return;
+        }
+      if (defrag_step ())
+        delay = DEFRAG_INTERVAL;
+      else
+        {
+          push_dir (ROOT_DIR_SECTOR);
+          delay = DEFRAG_PASS_INTERVAL;
+        }
+      lock_release (&defrag_lock);
+
+      /* Our own I/O does not count. */
+      last = block_io_cnt (fs_device);
+    }
+}
+
+/* Stops the defragmenter, waiting for the step in progress. */
+void
+defrag_done (void)
+{
+  lock_acquire (&defrag_lock);
+  stopping = true;
+  dir_close (cur);
+  cur = NULL;
+  while (!list_empty (&pending))
+    free (list_entry (list_pop_front (&pending), struct pending_dir, elem));
+  lock_release (&defrag_lock);
+}
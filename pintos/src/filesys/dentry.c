@@ -0,0 +1,175 @@
+/* Path name lookup cache.
+
+   Remembers which sector a name in a directory leads to, keyed by
+   the directory's inode sector and the name, so that resolving a
+   path again does not read the directories along it.  Names known
+   to be missing are cached too, as negative entries.
+
+   The directory code keeps the cache in step with the disk: it
+   fills it from dir_lookup() and updates it from dir_add() and
+   dir_remove() while holding the directory's lock.  When a
+   directory is created, entries left over from an earlier
+   directory at the same sector are purged. */
+
+#include "filesys/dentry.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Number of cached names. */
+#define DENTRY_CNT 128
+
+struct dentry
+  {
+    struct hash_elem elem;              /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru. */
+    block_sector_t parent;              /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Name within PARENT. */
+    block_sector_t child;               /* Inode sector, or DENTRY_NONE. */
+  };
+
+static struct dentry entries[DENTRY_CNT];
+static struct hash dentries;            /* Entries in use. */
+static struct list lru;                 /* All entries, least recent first. */
+static struct lock dentry_lock;         /* Guards all of the above. */
+
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, elem);
+  return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, elem);
+  return a->parent != b->parent ? a->parent < b->parent
+                                : strcmp (a->name, b->name) < 0;
+}
+
+/* Returns the entry for NAME in PARENT, or a null pointer.  Must
+   hold DENTRY_LOCK. */
+static struct dentry *
+dentry_find (block_sector_t parent, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.elem);
+  return e != NULL ? hash_entry (e, struct dentry, elem) : NULL;
+}
+
+/* Drops D from the table and makes it the next to be reused.
+   Must hold DENTRY_LOCK. */
+static void
+dentry_drop (struct dentry *d)
+{
+  hash_delete (&dentries, &d->elem);
+  d->parent = DENTRY_NONE;
+  list_remove (&d->lru_elem);
+  list_push_front (&lru, &d->lru_elem);
+}
+
+/* Initializes the path name lookup cache. */
+void
+dentry_init (void)
+{
+  int i;
+
+  if (!hash_init (&dentries, dentry_hash, dentry_less, NULL))
+    PANIC ("dentry cache creation failed");
+  list_init (&lru);
+  lock_init (&dentry_lock);
+  for (i = 0; i < DENTRY_CNT; i++)
+    {
+      entries[i].parent = DENTRY_NONE;
+      list_push_back (&lru, &entries[i].lru_elem);
+    }
+}
+
+/* Looks up NAME in the directory whose inode is at PARENT.  If it
+   is cached, stores the sector it leads to, or DENTRY_NONE if it
+   is known not to exist, into *CHILD and returns true.  Returns
+   false if the cache does not know. */
+bool
+dentry_lookup (block_sector_t parent, const char *name,
+               block_sector_t *child)
+{
+  struct dentry *d;
+
+  lock_acquire (&dentry_lock);
+  d = dentry_find (parent, name);
+  if (d != NULL)
+    {
+      *child = d->child;
+      list_remove (&d->lru_elem);
+      list_push_back (&lru, &d->lru_elem);
+    }
+  lock_release (&dentry_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in the directory whose inode is at PARENT
+   leads to CHILD, or does not exist if CHILD is DENTRY_NONE.
+   Names too long to ever exist are not cached. */
+void
+dentry_insert (block_sector_t parent, const char *name,
+               block_sector_t child)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+  lock_acquire (&dentry_lock);
+  d = dentry_find (parent, name);
+  if (d == NULL)
+    {
+      /* Reuse the least recently used entry. */
+      d = list_entry (list_front (&lru), struct dentry, lru_elem);
+      if (d->parent != DENTRY_NONE)
+        hash_delete (&dentries, &d->elem);
+      d->parent = parent;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->elem);
+    }
+  d->child = child;
+  list_remove (&d->lru_elem);
+  list_push_back (&lru, &d->lru_elem);
+  lock_release (&dentry_lock);
+}
+
+/* Forgets what is known about NAME in the directory whose inode
+   is at PARENT. */
+void
+dentry_invalidate (block_sector_t parent, const char *name)
+{
+  struct dentry *d;
+
+  lock_acquire (&dentry_lock);
+  d = dentry_find (parent, name);
+  if (d != NULL)
+    dentry_drop (d);
+  lock_release (&dentry_lock);
+}
+
+/* Forgets every name cached for the directory whose inode is at
+   PARENT. */
+void
+dentry_purge (block_sector_t parent)
+{
+  int i;
+
+  lock_acquire (&dentry_lock);
+  for (i = 0; i < DENTRY_CNT; i++)
+    if (entries[i].parent == parent)
+      dentry_drop (&entries[i]);
+  lock_release (&dentry_lock);
+}
@@ -0,0 +1,19 @@
+#ifndef FILESYS_DENTRY_H
+#define FILESYS_DENTRY_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Child sector of a negative entry: the name is known not to
+   exist. */
+#define DENTRY_NONE ((block_sector_t) -1)
+
+void dentry_init (void);
+bool dentry_lookup (block_sector_t parent, const char *name,
+                    block_sector_t *child);
+void dentry_insert (block_sector_t parent, const char *name,
+                    block_sector_t child);
+void dentry_invalidate (block_sector_t parent, const char *name);
+void dentry_purge (block_sector_t parent);
+
+#endif /* filesys/dentry.h */
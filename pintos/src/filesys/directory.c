@@ -1,9 +1,12 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include "filesys/dentry.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/log.h"
 #include "threads/malloc.h"
 #include "userprog/syscall.h"
 #include "threads/thread.h"
@@ -18,12 +21,169 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Entries read at once while building an index. */
+#define INDEX_BATCH (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* In-memory index of a directory's entries, built on first use
+   and kept with the directory's inode while it stays open.  On
+   disk a directory is still a plain array of entries, so
+   dir_readdir() and old disks work unchanged.  Guarded by the
+   directory's inode lock. */
+struct dir_index
+  {
+    struct hash names;                  /* dir_slots in use, by name. */
+    struct list free_slots;             /* Free dir_slots. */
+  };
+
+/* One entry position in an indexed directory. */
+struct dir_slot
+  {
+    struct hash_elem elem;              /* Element in names. */
+    struct list_elem free_elem;         /* Element in free_slots. */
+    char name[NAME_MAX + 1];            /* Name, if in use. */
+    off_t ofs;                          /* Offset of the entry. */
+  };
+
+/* Most memory file systems mounted at once. */
+#define MOUNT_MAX 8
+
+/* A memory file system, mounted over a disk directory, which
+   lookups then find its root in place of.  Mounts are only ever
+   added, at boot, so the table is read without a lock. */
+struct mount
+  {
+    block_sector_t covered;             /* Directory mounted over. */
+    block_sector_t root;                /* Memory root directory. */
+  };
+
+static struct mount mounts[MOUNT_MAX];
+static size_t mount_cnt;
+
+/* Returns the root of the memory file system mounted over
+   SECTOR, or SECTOR itself if there is none. */
+static block_sector_t
+mount_cross (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < mount_cnt; i++)
+    if (mounts[i].covered == sector)
+      return mounts[i].root;
+  return sector;
+}
+
+static unsigned
+dir_slot_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_string (hash_entry (e, struct dir_slot, elem)->name);
+}
+
+static bool
+dir_slot_less (const struct hash_elem *a, const struct hash_elem *b,
+               void *aux UNUSED)
+{
+  return strcmp (hash_entry (a, struct dir_slot, elem)->name,
+                 hash_entry (b, struct dir_slot, elem)->name) < 0;
+}
+
+static void
+dir_slot_free (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct dir_slot, elem));
+}
+
+/* Frees INDEX.  Null pointers are ignored. */
+void
+dir_index_destroy (struct dir_index *index)
+{
+  if (index == NULL)
+    return;
+  while (!list_empty (&index->free_slots))
+    free (list_entry (list_pop_front (&index->free_slots),
+                      struct dir_slot, free_elem));
+  hash_destroy (&index->names, dir_slot_free);
+  free (index);
+}
+
+/* Returns the index of DIR, reading the whole directory to build
+   it if there is none yet.  Returns a null pointer if memory runs
+   out, in which case callers fall back to scanning.  Must hold
+   DIR's inode lock. */
+static struct dir_index *
+dir_get_index (const struct dir *dir)
+{
+  struct dir_index *index = inode_get_dir_index (dir->inode);
+  struct dir_entry e[INDEX_BATCH];
+  struct dir_slot *slot;
+  off_t ofs = 0, n, i;
+
+  if (index != NULL)
+    return index;
+  index = malloc (sizeof *index);
+  if (index == NULL)
+    return NULL;
+  list_init (&index->free_slots);
+  if (!hash_init (&index->names, dir_slot_hash, dir_slot_less, NULL))
+    {
+      free (index);
+      return NULL;
+    }
+
+  do
+    {
+      n = inode_read_at (dir->inode, e, sizeof e, ofs) / sizeof *e;
+      for (i = 0; i < n; i++, ofs += sizeof *e)
+        {
+          slot = malloc (sizeof *slot);
+          if (slot == NULL)
+            {
+              dir_index_destroy (index);
+              return NULL;
+            }
+          slot->ofs = ofs;
+          if (e[i].in_use)
+            {
+              strlcpy (slot->name, e[i].name, sizeof slot->name);
+              hash_insert (&index->names, &slot->elem);
+            }
+          else
+            list_push_back (&index->free_slots, &slot->free_elem);
+        }
+    }
+  while (n == (off_t) INDEX_BATCH);
+
+  inode_set_dir_index (dir->inode, index);
+  return index;
+}
+
+/* Returns the slot for NAME in INDEX, or a null pointer. */
+static struct dir_slot *
+dir_index_find (struct dir_index *index, const char *name)
+{
+  struct dir_slot key;
+  struct hash_elem *e;
+
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&index->names, &key.elem);
+  return e != NULL ? hash_entry (e, struct dir_slot, elem) : NULL;
+}
+
+/* Drops DIR's index after a change it could not follow.  It is
+   rebuilt on next use. */
+static void
+dir_drop_index (const struct dir *dir)
+{
+  dir_index_destroy (inode_get_dir_index (dir->inode));
+  inode_set_dir_index (dir->inode, NULL);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
   if (inode_create (sector, entry_cnt * sizeof (struct dir_entry))) {
+    dentry_purge (sector);
     struct inode * inode = inode_open (sector);
     inode_set_dir (inode);
     struct dir * dir = dir_open (inode);
@@ -93,17 +253,34 @@ dir_get_inode (struct dir *dir)
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   Must hold DIR's inode lock. */
 static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
+  struct dir_index *index;
+  struct dir_slot *slot;
   struct dir_entry e;
   size_t ofs;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  index = dir_get_index (dir);
+  if (index != NULL)
+    {
+      slot = dir_index_find (index, name);
+      if (slot == NULL
+          || inode_read_at (dir->inode, &e, sizeof e, slot->ofs) != sizeof e)
+        return false;
+      if (ep != NULL)
+        *ep = e;
+      if (ofsp != NULL)
+        *ofsp = slot->ofs;
+      return true;
+    }
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
@@ -120,20 +297,31 @@ lookup (const struct dir *dir, const char *name,
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   A directory with a memory file system mounted over it is found
+   as the root of that instead.
+   The entry is opened under DIR's lock, so a concurrent
+   dir_remove() cannot free the inode in between.  Answers come
+   from the dentry cache when it has them. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t parent, child;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  parent = inode_get_inumber (dir->inode);
+  inode_lock (dir->inode);
+  if (!dentry_lookup (parent, name, &child))
+    {
+      child = lookup (dir, name, &e, NULL) ? e.inode_sector : DENTRY_NONE;
+      dentry_insert (parent, name, child);
+    }
+  *inode = child != DENTRY_NONE ? inode_open (mount_cross (child)) : NULL;
+  inode_unlock (dir->inode);
 
   return *inode != NULL;
 }
@@ -142,11 +330,13 @@ dir_lookup (const struct dir *dir, const char *name,
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), if DIR has been
+   removed, or if a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_index *index;
+  struct dir_slot *slot;
   struct dir_entry e;
   off_t ofs;
   bool success = false;
@@ -158,59 +348,99 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  inode_lock (dir->inode);
+
+  /* Check that DIR is still there and NAME is not in use.  Removing
+     a directory holds its lock, so it cannot happen in between. */
+  if (inode_is_removed (dir->inode) || lookup (dir, name, NULL, NULL))
     goto done;
 
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
-     current end-of-file.
+     current end-of-file.  The index remembers free slots;
+     without one, scan for them.
      
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  index = dir_get_index (dir);
+  slot = NULL;
+  if (index != NULL && !list_empty (&index->free_slots))
+    {
+      slot = list_entry (list_pop_front (&index->free_slots),
+                         struct dir_slot, free_elem);
+      ofs = slot->ofs;
+    }
+  else if (index != NULL)
+    ofs = inode_length (dir->inode);
+  else
+    for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+         ofs += sizeof e) 
+      if (!e.in_use)
+        break;
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    dentry_insert (inode_get_inumber (dir->inode), name, inode_sector);
+
+  /* Record it in the index. */
+  if (index != NULL && !success)
+    {
+      if (slot != NULL)
+        list_push_front (&index->free_slots, &slot->free_elem);
+    }
+  else if (index != NULL)
+    {
+      if (slot == NULL)
+        slot = malloc (sizeof *slot);
+      if (slot == NULL)
+        dir_drop_index (dir);
+      else
+        {
+          strlcpy (slot->name, name, sizeof slot->name);
+          slot->ofs = ofs;
+          hash_insert (&index->names, &slot->elem);
+        }
+    }
 
   /* Write .. infomation for true subdir */
   if (success && inode_sector != inode_get_inumber (dir->inode)) {
     struct inode* inode = inode_open (inode_sector);
     if(inode_is_dir (inode) || (inode_close (inode), 0)) {
       struct dir *subdir = dir_open (inode);
+      inode_lock (subdir->inode);
       lookup (subdir, "..", &e, &ofs);
       e.inode_sector = inode_get_inumber(dir->inode);
       inode_write_at(subdir->inode, &e, sizeof e, ofs);
+      dentry_invalidate (inode_sector, "..");
+      inode_unlock (subdir->inode);
       dir_close (subdir);
     }
   }
  done:
+  inode_unlock (dir->inode);
   return success;
 }
 
-/* Removes any entry for NAME in DIR.
-   Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
-bool
-dir_remove (struct dir *dir, const char *name) 
+/* Removes any entry for NAME in DIR, as dir_remove() does.  Must
+   hold DIR's lock, within a log operation. */
+static bool
+remove_entry (struct dir *dir, const char *name)
 {
+  struct dir_index *index;
+  struct dir_slot *slot;
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
   off_t ofs;
 
-  ASSERT (dir != NULL);
-  ASSERT (name != NULL);
-
-  /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  /* Find directory entry.  Mount points stay. */
+  if (!lookup (dir, name, &e, &ofs)
+      || mount_cross (e.inode_sector) != e.inode_sector)
     goto done;
 
   /* Open inode. */
@@ -222,6 +452,15 @@ dir_remove (struct dir *dir, const char *name)
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  dentry_insert (inode_get_inumber (dir->inode), name, DENTRY_NONE);
+
+  /* Move its slot to the free list. */
+  index = inode_get_dir_index (dir->inode);
+  if (index != NULL && (slot = dir_index_find (index, name)) != NULL)
+    {
+      hash_delete (&index->names, &slot->elem);
+      list_push_front (&index->free_slots, &slot->free_elem);
+    }
 
   /* Remove inode. */
   inode_remove (inode);
@@ -232,6 +471,25 @@ dir_remove (struct dir *dir, const char *name)
   return success;
 }
 
+/* Removes any entry for NAME in DIR.
+   Returns true if successful, false on failure,
+   which occurs only if there is no file with the given NAME. */
+bool
+dir_remove (struct dir *dir, const char *name) 
+{
+  bool success;
+
+  ASSERT (dir != NULL);
+  ASSERT (name != NULL);
+
+  log_begin ();
+  inode_lock (dir->inode);
+  success = remove_entry (dir, name);
+  inode_unlock (dir->inode);
+  log_end ();
+  return success;
+}
+
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
    contains no more entries. */
@@ -257,22 +515,52 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 }
 
 
+/* Gets *SECTOR for a new inode in DIR, near HINT: a memory inode
+   number in a memory file system, a free sector otherwise. */
+static bool
+new_inode_sector (struct dir *dir, block_sector_t hint,
+                  block_sector_t *sector)
+{
+  if (inode_is_mem (inode_get_inumber (dir->inode)))
+    {
+      *sector = inode_alloc_mem ();
+      return true;
+    }
+  return free_map_allocate_near (hint, 1, sector);
+}
+
+/* Gives back SECTOR, from new_inode_sector(), after a failed
+   create. */
+static void
+drop_inode_sector (block_sector_t sector)
+{
+  struct inode *inode;
+
+  if (!inode_is_mem (sector))
+    free_map_release (sector, 1);
+  else if ((inode = inode_open (sector)) != NULL)
+    {
+      inode_remove (inode);
+      inode_close (inode);
+    }
+}
+
 bool
 dir_subdir_create (struct dir* dir, const char* name) {
   block_sector_t sector = -1u;
-  if (  dir != NULL
+  bool success;
+  log_begin ();
+  success = dir != NULL
     &&  name != NULL
     &&  strlen(name) > 0
-    &&  free_map_allocate(1, &sector)
+    &&  new_inode_sector(dir, free_map_group_hint(), &sector)
     &&  dir_create(sector, 0)
-    &&  dir_add(dir, name, sector)
-    ) {
-    return true;
+    &&  dir_add(dir, name, sector);
+  if (!success && sector != -1u) {
+    drop_inode_sector(sector);
   }
-  if (sector != -1u) {
-    free_map_release(sector, 1);
-  }
-  return false;
+  log_end ();
+  return success;
 }
 
 struct dir*
@@ -290,9 +578,14 @@ dir_subdir_lookup (struct dir* dir, const char* name) {
   return NULL;
 }
 
+/* Removes the empty directory NAME from DIR.  The checks and the
+   removal happen under DIR's lock and then the subdirectory's, so
+   that nothing can be added to it or open it by name meanwhile. */
 bool
 dir_subdir_delete (struct dir* dir, const char* name) {
   struct inode* inode = NULL;
+  struct dir_entry e;
+  bool success = false;
   if (  dir != NULL
     &&  name != NULL
     &&  strlen(name) > 0
@@ -301,39 +594,51 @@ dir_subdir_delete (struct dir* dir, const char* name) {
     &&  ( (
               inode_is_dir(inode)
           &&  inode_get_inumber(inode) != inode_get_inumber(dir_get_inode(thread_current()->dir))
-          &&  inode_get_open_cnt(inode) <= 1
           )
         || (inode_close(inode), 0)
         )
     ) {
       struct dir* checker = dir_open(inode);
       char* buffer = calloc(NAME_MAX + 1, 1);
-      bool not_empty = dir_readdir (checker, buffer);
+      if (checker == NULL || buffer == NULL) {
+        dir_close (checker);
+        free (buffer);
+        return false;
+      }
+      log_begin ();
+      inode_lock (dir->inode);
+      inode_lock (inode);
+      if (  lookup (dir, name, &e, NULL)
+        &&  e.inode_sector == inode_get_inumber (inode)
+        &&  inode_get_open_cnt(inode) <= 1
+        &&  !dir_readdir (checker, buffer)) {
+        success = remove_entry (dir, name);
+      }
+      inode_unlock (inode);
+      inode_unlock (dir->inode);
+      log_end ();
       dir_close (checker);
       free (buffer);
-      if (!not_empty) {
-        return dir_remove (dir, name);
-      }
   }
-  return false;
+  return success;
 }
 
 bool
 dir_subfile_create(struct dir* dir, const char* name, off_t initial_size) {
   block_sector_t sector = -1u;
-  if (  dir != NULL
+  bool success;
+  log_begin ();
+  success = dir != NULL
     &&  name != NULL
     &&  strlen(name) > 0
-    &&  free_map_allocate(1, &sector)
+    &&  new_inode_sector(dir, inode_get_inumber(dir->inode), &sector)
     &&  inode_create(sector, initial_size)
-    &&  dir_add(dir, name, sector)
-    ) {
-    return true;
-  }
-  if (sector != -1u) {
-    free_map_release(sector, 1);
+    &&  dir_add(dir, name, sector);
+  if (!success && sector != -1u) {
+    drop_inode_sector(sector);
   }
-  return false;
+  log_end ();
+  return success;
 }
 
 struct file*
@@ -369,6 +674,60 @@ dir_subfile_delete(struct dir* dir, const char* name) {
   return false;
 }
 
+/* Mounts a new, empty memory file system over directory NAME in
+   DIR, creating the directory first if there is none.  Files and
+   directories made under it afterward live in kernel pages only
+   and are gone at shutdown.  Returns true if successful. */
+bool
+dir_mount (struct dir *dir, const char *name)
+{
+  struct inode *inode = NULL;
+  struct dir *root;
+  struct dir_entry e;
+  block_sector_t sector = -1u;
+  bool success = false;
+  off_t ofs;
+
+  if (mount_cnt >= MOUNT_MAX
+      || (!dir_lookup (dir, name, &inode)
+          && !(dir_subdir_create (dir, name)
+               && dir_lookup (dir, name, &inode))))
+    return false;
+
+  /* Neither a file nor a memory directory will do. */
+  if (inode_is_dir (inode) && !inode_is_mem (inode_get_inumber (inode)))
+    {
+      sector = inode_alloc_mem ();
+      if (dir_create (sector, 16)
+          && (root = dir_open (inode_open (sector))) != NULL)
+        {
+          /* Its ".." leads back out of the mount. */
+          inode_lock (root->inode);
+          if (lookup (root, "..", &e, &ofs))
+            {
+              e.inode_sector = inode_get_inumber (dir->inode);
+              success = inode_write_at (root->inode, &e, sizeof e, ofs)
+                        == sizeof e;
+            }
+          dentry_invalidate (sector, "..");
+          inode_unlock (root->inode);
+          dir_close (root);
+        }
+    }
+
+  if (success)
+    {
+      mounts[mount_cnt].covered = inode_get_inumber (inode);
+      mounts[mount_cnt].root = sector;
+      mount_cnt++;
+    }
+  else if (sector != -1u)
+    drop_inode_sector (sector);
+  inode_close (inode);
+  return success;
+}
+
+
 bool
 dir_is_dirfile(struct fd_t* h) {
   return inode_is_dir(file_get_inode(h->ptr));
@@ -14,6 +14,7 @@
 #define NAME_MAX 14
 
 struct inode;
+struct dir_index;
 
 /* A directory. Moved from directory.h . */
 struct dir 
@@ -37,6 +38,7 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, block_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+void dir_index_destroy (struct dir_index *);
 
 bool dir_subdir_create (struct dir*, const char* name);
 struct dir* dir_subdir_lookup (struct dir*, const char* name);
@@ -48,4 +50,6 @@ bool dir_subfile_delete(struct dir* , const char* name);
 
 bool dir_is_dirfile(struct fd_t*);
 
+bool dir_mount (struct dir *, const char *name);
+
 #endif /* filesys/directory.h */
@@ -6,6 +6,9 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/defrag.h"
+#include "filesys/dentry.h"
+#include "filesys/log.h"
 #include "cache.h"
 #include "threads/malloc.h"
 #include "lib/user/syscall.h"
@@ -14,6 +17,8 @@
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+size_t filesys_block_size = BLOCK_SECTOR_SIZE;
+
 static void do_format (void);
 
 /* Initializes the file system module.
@@ -26,13 +31,16 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  dentry_init ();
   free_map_init ();
   cache_init ();
+  log_init (format);
 
   if (format) 
     do_format ();
 
   free_map_open ();
+  defrag_init ();
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -40,7 +48,10 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  defrag_done ();
+  inode_done ();
   free_map_close ();
+  log_done ();
   cache_done ();
 }
 
@@ -152,15 +163,39 @@ filesys_remove (const char *name)
 #endif
 }
 
+/* Mounts an empty memory file system, a tmpfs, over the
+   directory NAME, which is created if it does not exist yet.
+   Returns true if successful, false on failure.
+   Fails if NAME is a file or already in a tmpfs, or if its
+   parent directory does not exist. */
+bool
+filesys_mount_tmpfs (const char *name)
+{
+  struct dir* dir;
+  char *pure_name = calloc (READDIR_MAX_LEN + 1, 1);
+  bool is_dir;
+  bool success = false;
+  if (name != NULL && strlen (name) > 0 && !filesys_is_root_dir (name) && filesys_path_parse (name, &dir, &pure_name, &is_dir)) {
+    success = dir_mount (dir, pure_name);
+    dir_close (dir);
+  }
+  free (pure_name);
+  return success;
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
-  free_map_create ();
+  free_map_create (filesys_block_size);
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
+
+  /* Mounting looks for the format in the free map's inode before
+     anything else, so it goes home now. */
+  cache_sync (FREE_MAP_SECTOR);
   printf ("done.\n");
 }
 
@@ -2,14 +2,20 @@
 #define FILESYS_FILESYS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define LOG_SECTOR 2            /* Metadata log, LOG_SECTORS long. */
 
 /* Block device that contains the file system. */
 struct block *fs_device;
+
+/* Bytes per block of a newly formatted file system, chosen with
+   the "-blocksize" kernel command-line option. */
+extern size_t filesys_block_size;
 struct dir;
 
 void filesys_init (bool format);
@@ -17,6 +23,7 @@ void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
+bool filesys_mount_tmpfs (const char *name);
 
 bool filesys_is_root_dir (const char* name);
 
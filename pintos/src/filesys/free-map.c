@@ -1,85 +1,459 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/log.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Bits of the free map held by one sector of its file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Ticks between writes of the changed parts of the free map. */
+#define FREE_MAP_FLUSH_INTERVAL TIMER_FREQ
+
+/* Blocks per allocation group.  The disk is split into groups of
+   this size; new directories go to the emptiest group and their
+   files' inodes and data follow them there. */
+#define GROUP_BLOCKS 512
+
+/* Space is handed out in blocks of 1 << block_shift sectors,
+   chosen when the file system is formatted and recorded in the
+   free map's inode.  Every allocation starts on a block boundary
+   and is rounded up to whole blocks, but callers still count in
+   sectors. */
+static unsigned block_shift;
 
 static struct file *free_map_file;   /* Free map file. */
-static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *free_map;      /* Free map, one bit per block. */
+static struct bitmap *dirty_sectors; /* Free map file sectors not yet
+                                        written, one bit each. */
+static size_t *group_free;           /* Free blocks in each group. */
+static size_t group_cnt;             /* Number of groups. */
+static size_t free_cnt;              /* Free blocks in all groups. */
+static size_t reserved_cnt;          /* Free sectors promised by
+                                        free_map_reserve(). */
+static struct lock free_map_lock;    /* Guards all of the above. */
 
-/* Initializes the free map. */
-void
-free_map_init (void) 
+static void free_map_flusher (void *);
+
+/* Returns the number of blocks needed for CNT sectors. */
+static size_t
+to_blocks (size_t cnt)
+{
+  return DIV_ROUND_UP (cnt, (size_t) 1 << block_shift);
+}
+
+/* Returns the number of sectors that are free and not reserved,
+   other than those reserved sectors that the current thread is
+   allowed to allocate.  Must hold FREE_MAP_LOCK. */
+static size_t
+available (void)
+{
+  return (free_cnt << block_shift) - reserved_cnt
+         + thread_current ()->reserve_spent;
+}
+
+/* Records that the bits for CNT blocks starting at BLOCK have
+   changed.  Must hold FREE_MAP_LOCK. */
+static void
+mark_dirty (size_t block, size_t cnt)
 {
-  free_map = bitmap_create (block_size (fs_device));
+  size_t first = block / BITS_PER_SECTOR;
+  size_t last = (block + cnt - 1) / BITS_PER_SECTOR;
+
+  if (cnt > 0)
+    bitmap_set_multiple (dirty_sectors, first, last - first + 1, true);
+}
+
+/* Marks CNT blocks starting at BLOCK as used if USED is true, or
+   free otherwise, keeping the group counts and dirty sectors up
+   to date.  Must hold FREE_MAP_LOCK. */
+static void
+set_blocks (size_t block, size_t cnt, bool used)
+{
+  size_t end = block + cnt, next;
+  size_t g;
+
+  bitmap_set_multiple (free_map, block, cnt, used);
+  mark_dirty (block, cnt);
+  for (; block < end; block = next)
+    {
+      g = block / GROUP_BLOCKS;
+      next = (g + 1) * GROUP_BLOCKS < end ? (g + 1) * GROUP_BLOCKS : end;
+      if (used)
+        {
+          group_free[g] -= next - block;
+          free_cnt -= next - block;
+        }
+      else
+        {
+          group_free[g] += next - block;
+          free_cnt += next - block;
+        }
+    }
+}
+
+/* Recounts the free blocks in every group. */
+static void
+count_groups (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t g, start;
+
+  free_cnt = 0;
+  for (g = 0; g < group_cnt; g++)
+    {
+      start = g * GROUP_BLOCKS;
+      group_free[g] = bitmap_count (free_map, start,
+                                    size - start < GROUP_BLOCKS
+                                    ? size - start : GROUP_BLOCKS, false);
+      free_cnt += group_free[g];
+    }
+}
+
+/* Sets up an empty free map for blocks of 1 << SHIFT sectors,
+   with only the blocks that hold the fixed sectors marked used:
+   the free map and root directory inodes, then the log. */
+static void
+setup (unsigned shift)
+{
+  bitmap_destroy (free_map);
+  bitmap_destroy (dirty_sectors);
+  free (group_free);
+
+  block_shift = shift;
+  free_map = bitmap_create (block_size (fs_device) >> shift);
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
-  bitmap_mark (free_map, FREE_MAP_SECTOR);
-  bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  dirty_sectors = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                               BITS_PER_SECTOR));
+  if (dirty_sectors == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_BLOCKS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("allocation group creation failed");
+  bitmap_set_multiple (free_map, 0, to_blocks (LOG_SECTOR + LOG_SECTORS),
+                       true);
+  count_groups ();
+}
+
+/* Initializes the free map.  It is set up by free_map_create() or
+   free_map_open(), once the block size is known. */
+void
+free_map_init (void) 
+{
+  lock_init (&free_map_lock);
+  thread_create ("free_map_flusher", PRI_DEFAULT, free_map_flusher, NULL);
+}
+
+/* Returns the number of sectors in a block. */
+size_t
+free_map_block_sectors (void)
+{
+  return (size_t) 1 << block_shift;
+}
+
+/* Marks the CNT blocks starting at BLOCK in use, drawing first on
+   the reserved sectors the current thread may allocate.  Must hold
+   FREE_MAP_LOCK. */
+static void
+take_blocks (size_t block, size_t cnt)
+{
+  struct thread *t = thread_current ();
+  size_t used = cnt << block_shift;
+
+  if (used > t->reserve_spent)
+    used = t->reserve_spent;
+  t->reserve_spent -= used;
+  reserved_cnt -= used;
+  set_blocks (block, cnt, true);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (0, cnt, sectorp);
+}
+
+/* Like free_map_allocate(), but takes the first run at or after
+   HINT, wrapping around to the start of the disk if there is none
+   there, so that related sectors end up close together. */
+bool
+free_map_allocate_near (block_sector_t hint, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  size_t block = BITMAP_ERROR, start = hint >> block_shift;
+
+  cnt = to_blocks (cnt);
+  lock_acquire (&free_map_lock);
+  if (start >= bitmap_size (free_map))
+    start = 0;
+  if (available () >= cnt << block_shift)
+    {
+      block = bitmap_scan (free_map, start, cnt, false);
+      if (block == BITMAP_ERROR)
+        block = bitmap_scan (free_map, 0, cnt, false);
+    }
+  if (block != BITMAP_ERROR)
+    take_blocks (block, cnt);
+  lock_release (&free_map_lock);
+  if (block != BITMAP_ERROR)
+    *sectorp = block << block_shift;
+  return block != BITMAP_ERROR;
+}
+
+/* Returns the first sector of the allocation group with the most
+   free sectors, where a new directory should be placed. */
+block_sector_t
+free_map_group_hint (void)
+{
+  size_t g, best = 0;
+
+  lock_acquire (&free_map_lock);
+  for (g = 1; g < group_cnt; g++)
+    if (group_free[g] > group_free[best])
+      best = g;
+  lock_release (&free_map_lock);
+  return (best * GROUP_BLOCKS) << block_shift;
+}
+
+/* Sets aside CNT free sectors for a later allocation by the
+   caller, who either gives them back with free_map_unreserve() or
+   allocates them after free_map_spend().  Other allocations leave
+   reserved sectors alone.  Returns false if there are not enough
+   free sectors. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = available () >= cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Gives back CNT sectors set aside by free_map_reserve(). */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Lets the current thread allocate CNT sectors it set aside with
+   free_map_reserve(), which no other allocation can take in the
+   meantime.  free_map_unspend() gives back what it did not use. */
+void
+free_map_spend (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  thread_current ()->reserve_spent += cnt;
+  ASSERT (reserved_cnt >= thread_current ()->reserve_spent);
+  lock_release (&free_map_lock);
+}
+
+/* Gives back the reserved sectors free_map_spend() let the current
+   thread allocate that it has not. */
+void
+free_map_unspend (void)
+{
+  struct thread *t = thread_current ();
+
+  lock_acquire (&free_map_lock);
+  reserved_cnt -= t->reserve_spent;
+  t->reserve_spent = 0;
+  lock_release (&free_map_lock);
+}
+
+/* Allocates up to CNT consecutive sectors, preferring a run that
+   starts at HINT, and stores the first into *SECTORP.  Returns the
+   number of sectors allocated, which is 0 if the disk is full.
+   Callers that need all CNT sectors call again for the rest.  The
+   count is a multiple of the block size, so it may exceed CNT. */
+size_t
+free_map_allocate_run (block_sector_t hint, size_t cnt,
+                       block_sector_t *sectorp)
+{
+  size_t size = bitmap_size (free_map);
+  size_t block = BITMAP_ERROR, start = hint >> block_shift;
+  size_t n = 0;
+
+  cnt = to_blocks (cnt);
+  lock_acquire (&free_map_lock);
+  if (start >= size)
+    start = 0;
+  if (cnt > available () >> block_shift)
+    cnt = available () >> block_shift;
+  if (cnt > 0 && !bitmap_test (free_map, start))
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      /* Grow the run in place as far as it goes. */
+      for (n = 1; n < cnt && start + n < size; n++)
+        if (bitmap_test (free_map, start + n))
+          break;
+      block = start;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  else
+    {
+      /* Take the first run of CNT blocks after HINT, halving the
+         request until something fits. */
+      for (n = cnt; n > 0; n /= 2)
+        {
+          block = bitmap_scan (free_map, start, n, false);
+          if (block == BITMAP_ERROR)
+            block = bitmap_scan (free_map, 0, n, false);
+          if (block != BITMAP_ERROR)
+            break;
+        }
+    }
+  if (block == BITMAP_ERROR)
+    n = 0;
+  else
+    {
+      take_blocks (block, n);
+      *sectorp = block << block_shift;
+    }
+  lock_release (&free_map_lock);
+  return n << block_shift;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes the blocks covering CNT sectors starting at SECTOR, which
+   must start a block, available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
-  ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  ASSERT (sector % free_map_block_sectors () == 0);
+  log_forget (sector, to_blocks (cnt) << block_shift);
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_all (free_map, sector >> block_shift, to_blocks (cnt)));
+  set_blocks (sector >> block_shift, to_blocks (cnt), false);
+  lock_release (&free_map_lock);
+}
+
+/* Makes the CNT runs in RUNS available for use, as
+   free_map_release() does for each. */
+void
+free_map_release_runs (const struct free_run *runs, size_t cnt)
+{
+  size_t i, first, n;
+
+  if (cnt == 0)
+    return;
+  for (i = 0; i < cnt; i++)
+    log_forget (runs[i].start, to_blocks (runs[i].cnt) << block_shift);
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      ASSERT (runs[i].start % free_map_block_sectors () == 0);
+      first = runs[i].start >> block_shift;
+      n = to_blocks (runs[i].cnt);
+      ASSERT (bitmap_all (free_map, first, n));
+      set_blocks (first, n, false);
+    }
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
 void
 free_map_open (void) 
 {
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
+  struct inode *inode = inode_open (FREE_MAP_SECTOR);
+
+  if (inode == NULL)
+    PANIC ("can't open free map");
+  setup (inode_get_block_shift (inode));
+  free_map_file = file_open (inode);
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_groups ();
+}
+
+/* Writes the sectors of the free map file whose bits have changed
+   since they were last written.  The writes are a log operation,
+   so they reach the disk with the next commit. */
+void
+free_map_flush (void)
+{
+  size_t i;
+
+  log_begin ();
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    for (i = 0; i < bitmap_size (dirty_sectors); i++)
+      if (bitmap_test (dirty_sectors, i)
+          && bitmap_write_range (free_map, free_map_file,
+                                 i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+        bitmap_reset (dirty_sectors, i);
+  lock_release (&free_map_lock);
+  log_end ();
+}
+
+/* Free map write-behind thread. */
+static void
+free_map_flusher (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (FREE_MAP_FLUSH_INTERVAL);
+      free_map_flush ();
+    }
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
+  lock_acquire (&free_map_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
 }
 
-/* Creates a new free map file on disk and writes the free map to
-   it. */
+/* Creates a new free map file on disk, for blocks of BLOCK_SIZE
+   bytes, and writes the free map to it. */
 void
-free_map_create (void) 
+free_map_create (size_t block_size)
 {
+  struct inode *inode;
+  unsigned shift = 0;
+
+  ASSERT (block_size % BLOCK_SECTOR_SIZE == 0);
+  while (((size_t) BLOCK_SECTOR_SIZE << shift) < block_size)
+    shift++;
+  ASSERT (((size_t) BLOCK_SECTOR_SIZE << shift) == block_size);
+  setup (shift);
+
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
+  inode = inode_open (FREE_MAP_SECTOR);
+  if (inode == NULL)
+    PANIC ("can't open free map");
+  inode_set_block_shift (inode, shift);
+  free_map_file = file_open (inode);
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_sectors, false);
 }
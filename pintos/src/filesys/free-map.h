@@ -5,13 +5,32 @@
 #include <stddef.h>
 #include "devices/block.h"
 
+/* A run of consecutive sectors. */
+struct free_run
+  {
+    block_sector_t start;               /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+  };
+
 void free_map_init (void);
 void free_map_read (void);
-void free_map_create (void);
+void free_map_create (size_t block_size);
 void free_map_open (void);
 void free_map_close (void);
+void free_map_flush (void);
+size_t free_map_block_sectors (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (block_sector_t hint, size_t,
+                             block_sector_t *);
+block_sector_t free_map_group_hint (void);
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
+void free_map_spend (size_t);
+void free_map_unspend (void);
+size_t free_map_allocate_run (block_sector_t hint, size_t,
+                              block_sector_t *);
 void free_map_release (block_sector_t, size_t);
+void free_map_release_runs (const struct free_run *, size_t);
 
 #endif /* filesys/free-map.h */
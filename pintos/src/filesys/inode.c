@@ -1,18 +1,27 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
 #include <stdlib.h>
+#include "devices/timer.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/log.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "threads/thread.h"
 #include "cache.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 /* Supporting 8MB file,
     8MB = 128 * 128 * 512
+    and 128 * 128 blocks in general, since an L2 entry maps a block.
     
     inode --> L1 --> L2 --> content
 
@@ -20,8 +29,72 @@
 
     The implementataion is refered to https://github.com/chenyxuan/PintOS
     which helps me understand wtf is the extensible files
+
+    New inodes instead map their data with up to EXTENT_CNT
+    (start, length) runs kept in the inode sector itself, and only
+    fall back to the tables above once the runs are used up.  Files
+    of at most INLINE_SIZE bytes keep their data in the inode
+    sector and have no data sectors at all.
  */
 #define TABLE_SIZE  128
+#define INODE_MAX_LENGTH (TABLE_SIZE * TABLE_SIZE * block_bytes ())
+
+/* Read-ahead window bounds, in sectors.  The window starts at
+   RA_MIN on the first sequential read, doubles on each further
+   sequential read up to RA_MAX, and drops to zero on a seek. */
+#define RA_MIN 2
+#define RA_MAX 16
+
+/* Most sectors inode_read_at() loads at once ahead of copying
+   them out. */
+#define FETCH_MAX 16
+
+/* Runs of freed sectors collected before the free map is
+   updated. */
+#define RELEASE_BATCH 32
+
+/* Most bytes of appended data an inode holds back from the disk
+   before allocating sectors for them. */
+#define DELAY_SECTORS 16
+#define DELAY_BYTES (DELAY_SECTORS * BLOCK_SECTOR_SIZE)
+
+/* Ticks after which held back data is given its sectors even if
+   the file stays open, and most inodes that happen to at once.
+   Open inodes are checked for it every DELAY_INTERVAL ticks. */
+#define DELAY_AGE (5 * TIMER_FREQ)
+#define AGED_MAX 16
+#define DELAY_INTERVAL TIMER_FREQ
+
+/* How an inode maps its data.  Inodes written before extents
+   existed have zero here and are indexed. */
+enum inode_layout
+  {
+    LAYOUT_INDEXED,                     /* L1 and L2 tables. */
+    LAYOUT_EXTENTS,                     /* Runs in the inode itself. */
+    LAYOUT_INLINE                       /* Data in the inode itself. */
+  };
+
+/* A run of LENGTH consecutive sectors starting at START. */
+struct extent
+  {
+    block_sector_t start;
+    uint32_t length;
+  };
+
+#define EXTENT_CNT 62
+
+/* Inode numbers from here up, short of -1, name memory inodes,
+   which live in kernel pages only and have no sectors at all.
+   They are handed out once each and never reused.  Their pages
+   come from the kernel pool, so all of them together may take at
+   most MEM_PAGE_MAX; writes past that come up short. */
+#define MEM_BASE ((block_sector_t) 0x80000000)
+#define MEM_PAGE_MAX 128
+
+/* Start of an extent, or table entry, with no sectors behind it.
+   Its bytes read as zeros. */
+#define HOLE ((block_sector_t) -1)
+#define INLINE_SIZE (EXTENT_CNT * sizeof (struct extent))
 
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
@@ -30,10 +103,24 @@ struct inode_disk
     block_sector_t table;               /* L1 Table for data sector. */
     off_t length;                       /* File size in bytes. */
     bool is_dir;                         /* is dir */
-    uint8_t unused[499];               /* Not used. */
+    uint8_t layout;                     /* enum inode_layout. */
+    uint8_t extent_cnt;                 /* Extents in use. */
+    uint8_t format;                     /* Free map only: FORMAT_*. */
+    union
+      {
+        struct extent extents[EXTENT_CNT]; /* Data runs, in file order. */
+        uint8_t inline_data[INLINE_SIZE];  /* File data, if inline. */
+      };
     unsigned magic;                     /* Magic number. */
   };
 
+/* The free map inode's FORMAT byte holds the block size, as log2
+   of sectors per block, and FORMAT_LOG if the disk was formatted
+   with room for the metadata log.  Disks formatted before either
+   existed have zero there. */
+#define FORMAT_SHIFT 0x0f
+#define FORMAT_LOG 0x10
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -42,104 +129,910 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* Returns the number of bytes in a block, the unit in which the
+   free map hands out space. */
+static inline off_t
+block_bytes (void)
+{
+  return free_map_block_sectors () * BLOCK_SECTOR_SIZE;
+}
+
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
+    struct list_elem reclaim_elem;      /* Element in reclaim_list. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rwlock rw;                   /* Guards data and deny_write_cnt. */
+    struct lock map_lock;               /* Guards l1_loaded, l1, l2,
+                                           writes. */
+    unsigned writes;                    /* Writes so far, so that
+                                           inode_defrag() can tell. */
+    struct lock dir_lock;               /* Serializes directory updates. */
+    struct dir_index *dir_index;        /* Name index, or null. */
+    block_sector_t cursor;              /* Where allocation looks next. */
+
+    /* Appended data not yet given sectors, covering bytes
+       DELAY_START through DELAY_START + DELAY_LEN - 1.  DATA's
+       length already includes it. */
+    uint8_t *delay_buf;                 /* DELAY_BYTES, or null. */
+    off_t delay_start;                  /* Block aligned. */
+    off_t delay_len;                    /* 0 if nothing is held back. */
+    size_t delay_reserved;              /* Sectors reserved for it. */
+    int64_t delay_since;                /* Tick it started being held. */
+    off_t ra_next;                      /* Sector a sequential read hits next. */
+    off_t ra_end;                       /* Read-ahead issued up to this sector. */
+    int ra_window;                      /* Current read-ahead window. */
     struct inode_disk data;             /* Inode content. */
+
+    /* Decoded copy of the index tables, filled in lazily by
+       byte_to_sector() and dropped whenever they change. */
+    bool l1_loaded;                     /* L1 holds the L1 table. */
+    block_sector_t l1[TABLE_SIZE];      /* L1 table. */
+    block_sector_t *l2[TABLE_SIZE];     /* Loaded L2 tables, or null. */
+
+    /* Data of a memory inode, one kernel page per PGSIZE bytes.
+       Pages never written are null and read as zeros. */
+    uint8_t **pages;                    /* PAGE_CNT page pointers. */
+    size_t page_cnt;
   };
 
-/*
+/* An L2 entry holds the first sector of a block.  With 512-byte
+   blocks:
    L1    L2    off
 [23:17][16:10][9:0]
 */
-#define byte_to_l1_table(pos) (((pos) >> 16) & (TABLE_SIZE - 1))
-#define byte_to_l2_table(pos) (((pos) >>  9) & (TABLE_SIZE - 1))
+#define byte_to_l1_table(pos) ((pos) / block_bytes () / TABLE_SIZE \
+                               % TABLE_SIZE)
+#define byte_to_l2_table(pos) ((pos) / block_bytes () % TABLE_SIZE)
 
-static char zeros[BLOCK_SECTOR_SIZE];
 static char ones [BLOCK_SECTOR_SIZE];
 
+/* Returns INODE's I'th L2 table, loading it and the L1 table into
+   INODE if needed.  Returns a null pointer if the L2 table does
+   not exist or cannot be kept in memory. */
+static block_sector_t *
+inode_l2_table (struct inode *inode, off_t i)
+{
+  block_sector_t *l2;
+
+  lock_acquire (&inode->map_lock);
+  if (!inode->l1_loaded)
+    {
+      cache_read (inode->data.table, inode->l1);
+      inode->l1_loaded = true;
+    }
+  if (inode->l2[i] == NULL && inode->l1[i] != HOLE)
+    {
+      inode->l2[i] = malloc (BLOCK_SECTOR_SIZE);
+      if (inode->l2[i] != NULL)
+        cache_read (inode->l1[i], inode->l2[i]);
+    }
+  l2 = inode->l2[i];
+  lock_release (&inode->map_lock);
+  return l2;
+}
+
+/* Drops INODE's copy of the L1 table and of L2 tables FIRST
+   through LAST. */
+static void
+inode_drop_tables (struct inode *inode, off_t first, off_t last)
+{
+  off_t i;
+  inode->l1_loaded = false;
+  for (i = first; i <= last; i++)
+    {
+      free (inode->l2[i]);
+      inode->l2[i] = NULL;
+    }
+}
+
+/* Returns the sector holding the IDX'th sector of D's data, or -1
+   if it falls in a hole or past D's extents. */
+static block_sector_t
+extent_lookup (const struct inode_disk *d, off_t idx)
+{
+  int k;
+  for (k = 0; k < d->extent_cnt; k++)
+    {
+      if (idx < (off_t) d->extents[k].length)
+        return d->extents[k].start == HOLE ? HOLE
+                                           : d->extents[k].start + idx;
+      idx -= d->extents[k].length;
+    }
+  return -1;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (struct inode *inode, off_t pos, bool write) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
+  block_sector_t *l2, ret;
   ASSERT (inode != NULL);
-/*
-  if (pos < inode->data.length)
-    return inode->data.table + pos / BLOCK_SECTOR_SIZE;
+  if (pos >= inode->data.length || inode->data.layout == LAYOUT_INLINE)
+    return -1;
+  if (inode->data.layout == LAYOUT_EXTENTS)
+    return extent_lookup (&inode->data, pos / BLOCK_SECTOR_SIZE);
+
+  l2 = inode_l2_table (inode, byte_to_l1_table (pos));
+  if (l2 != NULL)
+    ret = l2[byte_to_l2_table (pos)];
   else
+    {
+      /* Out of memory: look the block up in the cache instead. */
+      if (inode->l1[byte_to_l1_table (pos)] == HOLE)
+        return -1;
+      l2 = cache_get (inode->l1[byte_to_l1_table (pos)], CACHE_READ);
+      ret = l2[byte_to_l2_table (pos)];
+      cache_put (l2);
+    }
+  if (ret == HOLE)
     return -1;
-*/
-  block_sector_t *l1 = calloc(TABLE_SIZE, sizeof *l1);
-  block_sector_t *l2 = calloc(TABLE_SIZE, sizeof *l2);
-  block_sector_t ret = -1;
-  if (pos >= inode->data.length) {
-    if (!write)
-      goto done;
-    off_t i, j, l1_st, l1_ed, l2_st, l2_ed, l, r;
-    l1_st = byte_to_l1_table(inode->data.length);
-    l2_st = byte_to_l2_table(inode->data.length);
-    l1_ed = byte_to_l1_table(pos);
-    l2_ed = byte_to_l2_table(pos);
-    
-    cache_read (inode->data.table, l1);
-    for (i = l1_st; i <= l1_ed; i++) {
-      l = (i == l1_st ? l2_st : 0);
-      r = (i == l1_ed ? l2_ed : TABLE_SIZE - 1);
-      
-      if (l1[i] == -1){
-        if (!free_map_allocate (1, &l1[i]))
+  return ret + pos % block_bytes () / BLOCK_SECTOR_SIZE;
+}
+
+/* Puts TABLE, the index table at SECTOR.  A table that is NEW is
+   unknown to the disk until what points to it commits, so it is
+   written out now instead of joining the log; only changes to
+   tables already in use are logged. */
+static void
+table_put (block_sector_t *table, block_sector_t sector, bool new)
+{
+  if (new)
+    {
+      cache_put (table);
+      cache_sync (sector);
+    }
+  else
+    log_put (table);
+}
+
+/* Allocates the data sectors, and the L2 tables indexing them,
+   for bytes START through END - 1 in the L1 table TABLE, skipping
+   those already allocated.  New data sectors are zeroed.  New
+   sectors are taken at or after *CURSOR, which is advanced past
+   each of them.  Returns false if the disk is full; sectors
+   allocated before that stay in the tables. */
+static bool
+table_allocate (block_sector_t table, block_sector_t *cursor,
+                off_t start, off_t end)
+{
+  block_sector_t *l1, *l2;
+  off_t i, j, l1_st, l1_ed, l2_st, l2_ed, l, r;
+  off_t spb = free_map_block_sectors ();
+  bool success = false, new;
+
+  if (start >= end)
+    return true;
+  l1_st = byte_to_l1_table(start);
+  l2_st = byte_to_l2_table(start);
+  l1_ed = byte_to_l1_table(end - 1);
+  l2_ed = byte_to_l2_table(end - 1);
+
+  l1 = cache_get (table, CACHE_WRITE);
+  for (i = l1_st; i <= l1_ed; i++) {
+    l = (i == l1_st ? l2_st : 0);
+    r = (i == l1_ed ? l2_ed : TABLE_SIZE - 1);
+
+    new = l1[i] == HOLE;
+    if (new){
+      if (!free_map_allocate_near (*cursor, 1, &l1[i]))
+        goto done;
+      *cursor = l1[i] + 1;
+      cache_write (l1[i], ones); // table init to -1
+    }
+
+    l2 = cache_get (l1[i], CACHE_WRITE);
+    for (j = l; j <= r; j++) {
+      if (l2[j] == HOLE) {
+        off_t k;
+        if (!free_map_allocate_near (*cursor, spb, &l2[j])) {
+          table_put (l2, l1[i], new);
           goto done;
-        cache_write (l1[i], ones); // table init to -1
-      }
-        
-      cache_read (l1[i], l2);
-      for (j = l; j <= r; j++) {
-        if (l2[j] == -1) {
-          if (!free_map_allocate (1, &l2[j]))
-            goto done;
-          cache_write (l2[j], zeros);
         }
+        for (k = 0; k < spb; k++)
+          cache_put (cache_get (l2[j] + k, CACHE_ZERO));
+        *cursor = l2[j] + spb;
       }
-      cache_write (l1[i], l2);
     }
-    cache_write (inode->data.table, l1);
-    inode->data.length = pos + 1;
-    cache_write (inode->sector, &inode->data);
+    table_put (l2, l1[i], new);
   }
+  success = true;
+done:
+  log_put (l1);
+  return success;
+}
 
-  cache_read (inode->data.table, l1);
-  cache_read (l1[byte_to_l1_table (pos)], l2);
-  ret = l2[byte_to_l2_table (pos)];
+/* Allocates sectors FIRST through END - 1 of D's data, zeroing
+   them.  Sectors before FIRST that D's extents do not reach yet
+   become a hole.  Each run is asked for right after the last data
+   extent, or at *CURSOR for the first, so a file that grows into
+   free space keeps a single extent, and *CURSOR is left just past
+   the last one.  Returns false if the disk is
+   full, if D runs out of extents, or if a sector in the range lies
+   in an existing hole, which extents cannot split; sectors
+   allocated before that stay in D. */
+static bool
+extents_allocate (struct inode_disk *d, block_sector_t *cursor,
+                  size_t first, size_t end)
+{
+  size_t have = 0, cnt, i;
+  block_sector_t start, hint = *cursor;
+  int k;
 
-done:
-  free(l1);
-  free(l2);
-  return ret;
+  for (k = 0; k < d->extent_cnt; k++)
+    {
+      if (d->extents[k].start == HOLE && have + d->extents[k].length > first
+          && have < end)
+        return false;
+      have += d->extents[k].length;
+      if (d->extents[k].start != HOLE)
+        hint = d->extents[k].start + d->extents[k].length;
+    }
+  if (have < first)
+    {
+      struct extent *last = d->extent_cnt > 0
+                            ? &d->extents[d->extent_cnt - 1] : NULL;
+      if (last != NULL && last->start == HOLE)
+        last->length += first - have;
+      else if (d->extent_cnt < EXTENT_CNT)
+        {
+          d->extents[d->extent_cnt].start = HOLE;
+          d->extents[d->extent_cnt].length = first - have;
+          d->extent_cnt++;
+        }
+      else
+        return false;
+      have = first;
+    }
+  while (have < end)
+    {
+      struct extent *last = d->extent_cnt > 0
+                            ? &d->extents[d->extent_cnt - 1] : NULL;
+      cnt = free_map_allocate_run (hint, end - have, &start);
+      if (cnt == 0)
+        return false;
+      if (last != NULL && last->start != HOLE && start == hint)
+        last->length += cnt;
+      else if (d->extent_cnt < EXTENT_CNT)
+        {
+          d->extents[d->extent_cnt].start = start;
+          d->extents[d->extent_cnt].length = cnt;
+          d->extent_cnt++;
+        }
+      else
+        {
+          free_map_release (start, cnt);
+          return false;
+        }
+      for (i = 0; i < cnt; i++)
+        cache_put (cache_get (start + i, CACHE_ZERO));
+      have += cnt;
+      hint = *cursor = start + cnt;
+    }
+  return true;
+}
+
+/* Converts D from extents to L1 and L2 tables mapping the same
+   blocks and holes.  Returns false, leaving D unchanged, if the tables
+   cannot be allocated.  The tables are all new, so they are
+   written out rather than logged, however large D is. */
+static bool
+extents_to_indexed (struct inode_disk *d, block_sector_t *cursor)
+{
+  block_sector_t table, *l1, *l2;
+  off_t spb = free_map_block_sectors ();
+  off_t idx = 0, i;
+  size_t n;
+  int k;
+
+  if (!free_map_allocate_near (*cursor, 1, &table))
+    return false;
+  l1 = cache_get (table, CACHE_ZERO);
+  memset (l1, -1, BLOCK_SECTOR_SIZE);
+  for (k = 0; k < d->extent_cnt; k++)
+    for (n = 0; n < d->extents[k].length; n++, idx++)
+      {
+        /* Extents start and end on block boundaries. */
+        if (d->extents[k].start == HOLE || idx % spb != 0)
+          continue;
+        i = idx / spb / TABLE_SIZE;
+        if (l1[i] == HOLE)
+          {
+            if (!free_map_allocate_near (table + 1, 1, &l1[i]))
+              goto fail;
+            cache_write (l1[i], ones); // table init to -1
+          }
+        l2 = cache_get (l1[i], CACHE_WRITE);
+        l2[idx / spb % TABLE_SIZE] = d->extents[k].start + n;
+        cache_put (l2);
+      }
+  for (i = 0; i < TABLE_SIZE; i++)
+    if (l1[i] != HOLE)
+      cache_sync (l1[i]);
+  table_put (l1, table, true);
+
+  d->table = table;
+  d->layout = LAYOUT_INDEXED;
+  d->extent_cnt = 0;
+  memset (d->extents, 0, sizeof d->extents);
+  return true;
+
+fail:
+  for (i = 0; i < TABLE_SIZE; i++)
+    if (l1[i] != HOLE)
+      free_map_release (l1[i], 1);
+  cache_put (l1);
+  free_map_release (table, 1);
+  return false;
+}
+
+/* Moves D's inline data out to a data sector, at or after
+   *CURSOR, that becomes D's first extent.  Returns false if the
+   disk is full. */
+static bool
+inline_to_extents (struct inode_disk *d, block_sector_t *cursor)
+{
+  block_sector_t start;
+  uint8_t *block;
+  size_t cnt, i;
+
+  cnt = free_map_allocate_run (*cursor, 1, &start);
+  if (cnt == 0)
+    return false;
+  *cursor = start + cnt;
+  block = cache_get (start, CACHE_ZERO);
+  memcpy (block, d->inline_data, INLINE_SIZE);
+  log_put (block);
+  for (i = 1; i < cnt; i++)
+    cache_put (cache_get (start + i, CACHE_ZERO));
+
+  memset (d->inline_data, 0, INLINE_SIZE);
+  d->layout = LAYOUT_EXTENTS;
+  d->extents[0].start = start;
+  d->extents[0].length = cnt;
+  d->extent_cnt = 1;
+  return true;
+}
+
+/* Allocates the sectors for bytes START through END - 1 of D,
+   leaving any others unallocated.  Free sectors are looked for
+   from *CURSOR on, and *CURSOR is left just past the last one
+   taken.
+   Inline data moves out once it no longer fits, and extents are
+   converted to tables when they cannot map the range.  Returns
+   false if the disk is full.
+   The range is widened to whole blocks, so that every block of
+   the file maps one block of the free map. */
+static bool
+disk_allocate (struct inode_disk *d, block_sector_t *cursor,
+               off_t start, off_t end)
+{
+  if (d->layout == LAYOUT_INLINE
+      && (end <= (off_t) INLINE_SIZE || !inline_to_extents (d, cursor)))
+    return end <= (off_t) INLINE_SIZE;
+  start = ROUND_DOWN (start, block_bytes ());
+  end = ROUND_UP (end, block_bytes ());
+  if (d->layout == LAYOUT_EXTENTS
+      && !extents_allocate (d, cursor, start / BLOCK_SECTOR_SIZE,
+                            bytes_to_sectors (end))
+      && !extents_to_indexed (d, cursor))
+    return false;
+  if (d->layout == LAYOUT_INDEXED)
+    return table_allocate (d->table, cursor, start, end);
+  return true;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Sectors waiting to be handed back to the free map. */
+struct release_batch
+  {
+    struct free_run runs[RELEASE_BATCH];
+    size_t cnt;
+  };
+
+/* Hands the sectors collected in B to the free map at once, as
+   soon as the log has committed what stopped using them. */
+static void
+release_flush (struct release_batch *b)
+{
+  log_release (b->runs, b->cnt);
+  b->cnt = 0;
+}
+
+/* Adds the CNT sectors starting at START to B, merging them into
+   the last run when they follow it. */
+static void
+release_add (struct release_batch *b, block_sector_t start, size_t cnt)
+{
+  struct free_run *last = b->cnt > 0 ? &b->runs[b->cnt - 1] : NULL;
+
+  if (last != NULL && last->start + last->cnt == start)
+    {
+      last->cnt += cnt;
+      return;
+    }
+  if (b->cnt == RELEASE_BATCH)
+    release_flush (b);
+  b->runs[b->cnt].start = start;
+  b->runs[b->cnt].cnt = cnt;
+  b->cnt++;
+}
+
+/* Adds every data and table sector of D to B. */
+static void
+disk_release (struct inode_disk *d, struct release_batch *b)
+{
+  block_sector_t *l1, *l2;
+  off_t i, j, spb = free_map_block_sectors ();
+  int k;
+
+  if (d->layout == LAYOUT_INLINE)
+    return;
+  if (d->layout == LAYOUT_EXTENTS)
+    {
+      for (k = 0; k < d->extent_cnt; k++)
+        if (d->extents[k].start != HOLE)
+          release_add (b, d->extents[k].start, d->extents[k].length);
+      return;
+    }
+
+  l1 = cache_get (d->table, CACHE_READ);
+  for (i = 0; i < TABLE_SIZE; i++)
+    if (l1[i] != HOLE)
+      {
+        l2 = cache_get (l1[i], CACHE_READ);
+        for (j = 0; j < TABLE_SIZE; j++)
+          if (l2[j] != HOLE)
+            release_add (b, l2[j], spb);
+        cache_put (l2);
+        release_add (b, l1[i], 1);
+      }
+  cache_put (l1);
+  release_add (b, d->table, 1);
+}
+
+/* Returns true if bytes START through END - 1 of INODE can be
+   written without allocating anything. */
+static bool
+inode_mapped (struct inode *inode, off_t start, off_t end)
+{
+  off_t pos;
+
+  if (end > inode->data.length)
+    return false;
+  if (inode->data.layout == LAYOUT_INLINE)
+    return true;
+  for (pos = start - start % BLOCK_SECTOR_SIZE; pos < end;
+       pos += BLOCK_SECTOR_SIZE)
+    if (byte_to_sector (inode, pos) == HOLE)
+      return false;
+  return true;
+}
+
+/* Returns true if INODE's data is metadata, which goes through the
+   log: directory entries and the free map.  File data does not. */
+static bool
+inode_is_meta (const struct inode *inode)
+{
+  return inode_is_dir (inode) || inode->sector == FREE_MAP_SECTOR;
+}
+
+/* Allocates the sectors for bytes START through END - 1 of INODE,
+   leaving holes elsewhere, and extends INODE to END bytes if it is
+   shorter.  Returns false if the file would be too large or the
+   disk is full, in which case INODE's length is unchanged. */
+static bool
+inode_allocate (struct inode *inode, off_t start, off_t end)
+{
+  bool success;
+
+  if (end > INODE_MAX_LENGTH)
+    return false;
+
+  success = disk_allocate (&inode->data, &inode->cursor, start, end);
+  inode_drop_tables (inode, byte_to_l1_table (start),
+                     byte_to_l1_table (end - 1));
+  if (success && end > inode->data.length)
+    inode->data.length = end;
+  log_write (inode->sector, &inode->data);
+  return success;
+}
+
+/* Gives INODE's held back data its sectors, all in one allocation
+   so that they end up contiguous, and moves the data into the
+   cache.  The allocation draws on the sectors inode_delay()
+   reserved, which cover the worst case, so it cannot run out.
+   Must hold INODE's lock for writing, or be its last opener. */
+static void
+inode_commit (struct inode *inode)
+{
+  off_t end = inode->delay_start + inode->delay_len;
+  block_sector_t sector;
+  uint8_t *block;
+  off_t pos;
+
+  if (inode->delay_len == 0)
+    return;
+  free_map_spend (inode->delay_reserved);
+  inode->delay_reserved = 0;
+  inode_allocate (inode, inode->delay_start, end);
+  free_map_unspend ();
+  for (pos = inode->delay_start; pos < end; pos += BLOCK_SECTOR_SIZE)
+    {
+      sector = byte_to_sector (inode, pos);
+      if (sector == HOLE)
+        continue;
+      block = cache_get (sector, CACHE_ZERO);
+      memcpy (block, inode->delay_buf + (pos - inode->delay_start),
+              BLOCK_SECTOR_SIZE);
+      if (inode_is_meta (inode))
+        log_put (block);
+      else
+        cache_put (block);
+    }
+  inode->delay_len = 0;
+}
+
+/* Returns the most sectors that allocating bytes DS through
+   END - 1 of INODE, which lie past its last allocated block, can
+   take: the data blocks plus a block for each index table that
+   may be added.  Extents that may run out are converted to tables,
+   which takes an L1 table and L2 tables for the whole file. */
+static size_t
+delay_worst_case (const struct inode *inode, off_t ds, off_t end)
+{
+  size_t spb = free_map_block_sectors ();
+  size_t data = ROUND_UP (bytes_to_sectors (end - ds), spb);
+  size_t tables;
+
+  if (inode->data.layout == LAYOUT_INDEXED)
+    tables = byte_to_l1_table (end - 1) - byte_to_l1_table (ds) + 1;
+  else if (inode->data.extent_cnt + data / spb <= EXTENT_CNT)
+    tables = 0;
+  else
+    tables = 1 + DIV_ROUND_UP (DIV_ROUND_UP (end, block_bytes ()),
+                               TABLE_SIZE);
+  return data + tables * spb;
+}
+
+/* Holds back the part of a write of SIZE bytes from BUFFER at
+   OFFSET that lies past INODE's last allocated sector, if it fits
+   in INODE's delay buffer.  Returns the number of bytes held back,
+   all at the end of the write; the caller writes the rest.  Must
+   hold INODE's lock for writing. */
+static off_t
+inode_delay (struct inode *inode, const uint8_t *buffer, off_t size,
+             off_t offset)
+{
+  off_t end = offset + size, start, ds;
+  size_t need;
+
+  if (inode->data.layout == LAYOUT_INLINE)
+    return 0;
+  ds = inode->delay_len > 0 ? inode->delay_start
+       : ROUND_UP (inode->data.length, block_bytes ());
+  if (end <= ds || end > INODE_MAX_LENGTH)
+    return 0;
+  if (end - ds > DELAY_BYTES)
+    {
+      /* Does not fit.  Make room for the next appends. */
+      inode_commit (inode);
+      return 0;
+    }
+
+  if (inode->delay_buf == NULL)
+    {
+      inode->delay_buf = malloc (DELAY_BYTES);
+      if (inode->delay_buf == NULL)
+        return 0;
+    }
+  /* Reserve enough that the allocation at commit time cannot run
+     out, since the write is reported done before then. */
+  need = delay_worst_case (inode, ds, end);
+  if (need > inode->delay_reserved)
+    {
+      if (!free_map_reserve (need - inode->delay_reserved))
+        {
+          /* The caller allocates the write's sectors itself, which
+             must not happen under held back data. */
+          inode_commit (inode);
+          return 0;
+        }
+      inode->delay_reserved = need;
+    }
+  if (inode->delay_len == 0)
+    {
+      memset (inode->delay_buf, 0, DELAY_BYTES);
+      inode->delay_start = ds;
+      inode->delay_since = timer_ticks ();
+    }
+
+  start = offset > ds ? offset : ds;
+  memcpy (inode->delay_buf + (start - ds), buffer + (start - offset),
+          end - start);
+  if (end - ds > inode->delay_len)
+    inode->delay_len = end - ds;
+  if (end > inode->data.length)
+    inode->data.length = end;
+  return end - start;
+}
+
+/* Copies the held back bytes of INODE from POS up to SIZE bytes
+   into BUFFER.  Returns the number copied, 0 if POS is not held
+   back. */
+static off_t
+inode_read_delayed (struct inode *inode, uint8_t *buffer, off_t size,
+                    off_t pos)
+{
+  off_t ofs = pos - inode->delay_start;
+
+  if (inode->delay_len == 0 || ofs < 0 || ofs >= inode->delay_len)
+    return 0;
+  if (size > inode->delay_len - ofs)
+    size = inode->delay_len - ofs;
+  memcpy (buffer, inode->delay_buf + ofs, size);
+  return size;
+}
+
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  Memory inodes stay here
+   even while nobody has them open, until they are removed.
+   OPEN_INODES_LOCK also guards each inode's OPEN_CNT and REMOVED,
+   NEXT_MEM, and MEM_PAGES. */
+static struct hash open_inodes;
+static struct inode open_key;           /* Lookup key for open_inodes. */
+static struct lock open_inodes_lock;
+static block_sector_t next_mem = MEM_BASE; /* Next memory inode number. */
+static size_t mem_pages;                /* Pages memory inodes hold. */
+
+/* Removed inodes whose last opener has closed them, waiting for
+   the inode_reclaimer thread to free their sectors.  RECLAIM_LOCK
+   guards the list; WORK_LOCK is held while sectors are freed. */
+static struct list reclaim_list;
+static struct lock reclaim_lock;
+static struct lock work_lock;
+static struct semaphore reclaim_sema;   /* Number of queued inodes. */
+
+static void inode_reclaimer (void *);
+static void delay_committer (void *);
+
+/* Returns true if SECTOR is the number of a memory inode rather
+   than a disk sector. */
+bool
+inode_is_mem (block_sector_t sector)
+{
+  return sector >= MEM_BASE;
+}
+
+/* Returns a fresh memory inode number, for inode_create(). */
+block_sector_t
+inode_alloc_mem (void)
+{
+  block_sector_t sector;
+
+  lock_acquire (&open_inodes_lock);
+  ASSERT (next_mem != HOLE);
+  sector = next_mem++;
+  lock_release (&open_inodes_lock);
+  return sector;
+}
+
+/* Sets up the in-memory state of INODE, at SECTOR, with nobody
+   having it open yet. */
+static void
+inode_setup (struct inode *inode, block_sector_t sector)
+{
+  inode->sector = sector;
+  inode->open_cnt = 0;
+  inode->deny_write_cnt = 0;
+  inode->removed = false;
+  rwlock_init (&inode->rw);
+  lock_init (&inode->map_lock);
+  inode->writes = 0;
+  lock_init (&inode->dir_lock);
+  inode->dir_index = NULL;
+  inode->cursor = sector + 1;
+  inode->delay_buf = NULL;
+  inode->delay_start = inode->delay_len = 0;
+  inode->delay_reserved = 0;
+  inode->delay_since = 0;
+  inode->ra_next = inode->ra_end = 0;
+  inode->ra_window = 0;
+  inode->l1_loaded = false;
+  memset (inode->l2, 0, sizeof inode->l2);
+  inode->pages = NULL;
+  inode->page_cnt = 0;
+}
+
+/* Creates memory inode SECTOR with LENGTH bytes of zeros.  It is
+   kept in open_inodes until removed, since that is the only place
+   it exists. */
+static bool
+mem_create (block_sector_t sector, off_t length)
+{
+  struct inode *inode;
+
+  if (length > INODE_MAX_LENGTH)
+    return false;
+  inode = malloc (sizeof *inode);
+  if (inode == NULL)
+    return false;
+  inode_setup (inode, sector);
+  memset (&inode->data, 0, sizeof inode->data);
+  inode->data.length = length;
+  inode->data.layout = LAYOUT_EXTENTS;
+  inode->data.magic = INODE_MAGIC;
+
+  lock_acquire (&open_inodes_lock);
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+  return true;
+}
+
+/* Frees memory inode INODE and its pages. */
+static void
+mem_free (struct inode *inode)
+{
+  size_t i, cnt = 0;
+
+  for (i = 0; i < inode->page_cnt; i++)
+    if (inode->pages[i] != NULL)
+      {
+        palloc_free_page (inode->pages[i]);
+        cnt++;
+      }
+  free (inode->pages);
+  lock_acquire (&open_inodes_lock);
+  mem_pages -= cnt;
+  lock_release (&open_inodes_lock);
+  dir_index_destroy (inode->dir_index);
+  free (inode);
+}
+
+/* Returns memory inode INODE's page for bytes PAGE * PGSIZE
+   onward, allocating it if needed, or a null pointer if memory
+   runs out or memory inodes already hold MEM_PAGE_MAX pages.
+   Must hold INODE's lock for writing. */
+static uint8_t *
+mem_page (struct inode *inode, size_t page)
+{
+  if (page >= inode->page_cnt)
+    {
+      size_t cnt = inode->page_cnt * 2 > page ? inode->page_cnt * 2 : page + 1;
+      uint8_t **pages = realloc (inode->pages, cnt * sizeof *pages);
+      if (pages == NULL)
+        return NULL;
+      memset (pages + inode->page_cnt, 0,
+              (cnt - inode->page_cnt) * sizeof *pages);
+      inode->pages = pages;
+      inode->page_cnt = cnt;
+    }
+  if (inode->pages[page] == NULL)
+    {
+      bool room;
+
+      lock_acquire (&open_inodes_lock);
+      room = mem_pages < MEM_PAGE_MAX;
+      if (room)
+        mem_pages++;
+      lock_release (&open_inodes_lock);
+      if (!room)
+        return NULL;
+      inode->pages[page] = palloc_get_page (PAL_ZERO);
+      if (inode->pages[page] == NULL)
+        {
+          lock_acquire (&open_inodes_lock);
+          mem_pages--;
+          lock_release (&open_inodes_lock);
+        }
+    }
+  return inode->pages[page];
+}
+
+/* inode_read_at() for memory inode INODE. */
+static off_t
+mem_read_at (struct inode *inode, uint8_t *buffer, off_t size, off_t offset)
+{
+  off_t bytes_read = 0;
+
+  rwlock_acquire_read (&inode->rw);
+  if (size > inode_length (inode) - offset)
+    size = inode_length (inode) - offset;
+  while (size > 0)
+    {
+      size_t page = offset / PGSIZE;
+      int page_ofs = offset % PGSIZE;
+      int chunk_size = size < PGSIZE - page_ofs ? size : PGSIZE - page_ofs;
+
+      if (page < inode->page_cnt && inode->pages[page] != NULL)
+        memcpy (buffer + bytes_read, inode->pages[page] + page_ofs,
+                chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
+
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_read += chunk_size;
+    }
+  rwlock_release_read (&inode->rw);
+  return bytes_read;
+}
+
+/* inode_write_at() for memory inode INODE.  Nothing here goes
+   near the log or the disk. */
+static off_t
+mem_write_at (struct inode *inode, const uint8_t *buffer, off_t size,
+              off_t offset)
+{
+  off_t bytes_written = 0;
+  uint8_t *kpage;
+
+  rwlock_acquire_write (&inode->rw);
+  if (inode->deny_write_cnt)
+    size = 0;
+  if (size > INODE_MAX_LENGTH - offset)
+    size = INODE_MAX_LENGTH - offset;
+  while (size > 0)
+    {
+      size_t page = offset / PGSIZE;
+      int page_ofs = offset % PGSIZE;
+      int chunk_size = size < PGSIZE - page_ofs ? size : PGSIZE - page_ofs;
+
+      kpage = mem_page (inode, page);
+      if (kpage == NULL)
+        break;
+      memcpy (kpage + page_ofs, buffer + bytes_written, chunk_size);
+
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_written += chunk_size;
+    }
+  if (bytes_written > 0 && offset > inode->data.length)
+    inode->data.length = offset;
+  rwlock_release_write (&inode->rw);
+  return bytes_written;
+}
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return hash_entry (a, struct inode, elem)->sector
+         < hash_entry (b, struct inode, elem)->sector;
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("open inode table creation failed");
+  lock_init (&open_inodes_lock);
+  list_init (&reclaim_list);
+  lock_init (&reclaim_lock);
+  lock_init (&work_lock);
+  sema_init (&reclaim_sema, 0);
+  thread_create ("inode_reclaimer", PRI_DEFAULT, inode_reclaimer, NULL);
+  thread_create ("delay_committer", PRI_DEFAULT, delay_committer, NULL);
   memset (ones, -1, sizeof ones);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  If SECTOR is a memory inode number, the inode is made
+   in memory instead.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
@@ -150,59 +1043,35 @@ inode_create (block_sector_t sector, off_t length)
 
   ASSERT (length >= 0);
 
+  if (inode_is_mem (sector))
+    return mem_create (sector, length);
+
   /* If this assertion fails, the inode structure is not exactly
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
-  disk_inode = calloc (1, sizeof *disk_inode);
+  /* Build the inode directly in its cache block. */
+  disk_inode = cache_get (sector, CACHE_ZERO);
   if (disk_inode != NULL)
     {
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
       disk_inode->is_dir = false;
-      if (free_map_allocate (1, &disk_inode->table)) 
+      disk_inode->layout = length <= (off_t) INLINE_SIZE
+                           ? LAYOUT_INLINE : LAYOUT_EXTENTS;
+      if (length <= INODE_MAX_LENGTH)
         {
-          cache_write (sector, disk_inode);
-          cache_write (disk_inode->table, ones);
-          if (length) {
-            block_sector_t *l1 = calloc(TABLE_SIZE, sizeof *l1);
-            block_sector_t *l2 = calloc(TABLE_SIZE, sizeof *l2);
-            off_t i, j, l1_ed, l2_ed, l, r;
-
-            l1_ed = byte_to_l1_table(length - 1);
-            l2_ed = byte_to_l2_table(length - 1);
-            
-            cache_read (disk_inode->table, l1);
-            for (i = 0; i <= l1_ed; i++) {
-              l = 0;
-              r = (i == l1_ed ? l2_ed : TABLE_SIZE - 1);
-              
-              if (l1[i] == -1){
-                if (!free_map_allocate (1, &l1[i]))
-                  goto done;
-                cache_write (l1[i], ones); // table init to -1
-              }
-                
-              cache_read (l1[i], l2);
-              for (j = l; j <= r; j++) {
-                if (l2[j] == -1) {
-                  if (!free_map_allocate (1, &l2[j]))
-                    goto done;
-                  cache_write (l2[j], zeros);
-                }
-              }
-              cache_write (l1[i], l2);
+          block_sector_t cursor = sector + 1;
+          success = disk_allocate (disk_inode, &cursor, 0, length);
+          if (!success)
+            {
+              struct release_batch b;
+              b.cnt = 0;
+              disk_release (disk_inode, &b);
+              release_flush (&b);
             }
-            cache_write (disk_inode->table, l1);
-            success = true;
-          done:
-            free(l1);
-            free(l2);
-          } else {
-            success = true; 
-          }
-        } 
-      free (disk_inode);
+        }
+      log_put (disk_inode);
     }
   return success;
 }
@@ -213,33 +1082,36 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct hash_elem *e;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&open_inodes_lock);
+  open_key.sector = sector;
+  e = hash_find (&open_inodes, &open_key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode; 
     }
 
-  /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  /* Allocate memory.  A memory inode not in the table is gone. */
+  inode = inode_is_mem (sector) ? NULL : malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
-  inode->sector = sector;
+  /* Initialize.  The table lock is held until the inode is read
+     in, so a concurrent opener never sees it half built. */
+  inode_setup (inode, sector);
+  hash_insert (&open_inodes, &inode->elem);
   inode->open_cnt = 1;
-  inode->deny_write_cnt = 0;
-  inode->removed = false;
   cache_read (inode->sector, &inode->data);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -248,7 +1120,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -261,7 +1137,8 @@ inode_get_inumber (const struct inode *inode)
 
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If INODE was also a removed inode, frees its blocks.  A memory
+   inode's memory is freed only once it is removed as well. */
 void
 inode_close (struct inode* inode) 
 {
@@ -270,40 +1147,52 @@ inode_close (struct inode* inode)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  if (--inode->open_cnt == 0 && inode_is_mem (inode->sector))
+    {
+      /* A memory inode goes only once it is removed as well. */
+      if (inode->removed)
+        hash_delete (&open_inodes, &inode->elem);
+      lock_release (&open_inodes_lock);
+      if (inode->removed)
+        mem_free (inode);
+    }
+  else if (inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      /* Remove from the open inode table.  Nobody else can reach
+         the inode now, so the rest needs no locks. */
+      hash_delete (&open_inodes, &inode->elem);
+      lock_release (&open_inodes_lock);
+
+      /* Held back data goes to disk now, unless the file is gone
+         anyway. */
+      if (!inode->removed && inode->delay_len > 0)
+        {
+          log_begin ();
+          inode_commit (inode);
+          log_end ();
+        }
+      else if (inode->delay_reserved > 0)
+        free_map_unreserve (inode->delay_reserved);
+      free (inode->delay_buf);
+      inode_drop_tables (inode, 0, TABLE_SIZE - 1);
+      dir_index_destroy (inode->dir_index);
  
-      /* Deallocate blocks if removed. */
-      if (inode->removed) {
-        if (inode->data.length) {
-          block_sector_t *l1 = calloc(TABLE_SIZE, sizeof *l1);
-          block_sector_t *l2 = calloc(TABLE_SIZE, sizeof *l2);
-          off_t i, j, l1_ed, l2_ed, l, r;
-
-          l1_ed = byte_to_l1_table(inode->data.length - 1);
-          l2_ed = byte_to_l2_table(inode->data.length - 1);
-          
-          cache_read (inode->data.table, l1);
-          for (i = 0; i <= l1_ed; i++) {
-            l = 0;
-            r = (i == l1_ed ? l2_ed : TABLE_SIZE - 1);
-            cache_read (l1[i], l2);
-            for (j = l; j <= r; j++) {
-              free_map_release (l2[j], 1);
-            }
-            free_map_release(l1[i], 1);
-          }
-          free(l1);
-          free(l2);
+      /* Leave the blocks of a removed inode to the reclaimer.  Its
+         sector stays allocated until then, so it cannot be reused
+         in the meantime. */
+      if (inode->removed)
+        {
+          lock_acquire (&reclaim_lock);
+          list_push_back (&reclaim_list, &inode->reclaim_elem);
+          lock_release (&reclaim_lock);
+          sema_up (&reclaim_sema);
         }
-        free_map_release (inode->sector, 1);
-        free_map_release (inode->data.table, 1);
-      }
-
-      free (inode); 
+      else
+        free (inode); 
     }
+  else
+    lock_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -312,7 +1201,72 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&open_inodes_lock);
   inode->removed = true;
+  lock_release (&open_inodes_lock);
+}
+
+/* Brings sectors FIRST through END - 1 of INODE into the cache,
+   one device request per run of consecutive disk sectors, in the
+   background if ASYNC.  Holes are skipped. */
+static void
+inode_fetch (struct inode *inode, off_t first, off_t end, bool async)
+{
+  block_sector_t start = HOLE, sector;
+  size_t cnt = 0;
+  off_t i;
+
+  for (i = first; i <= end; i++)
+    {
+      sector = i < end ? byte_to_sector (inode, i * BLOCK_SECTOR_SIZE) : HOLE;
+      if (cnt > 0 && sector != HOLE && sector == start + cnt)
+        {
+          cnt++;
+          continue;
+        }
+      if (cnt > 0 && async)
+        cache_readahead (start, cnt);
+      else if (cnt > 0)
+        cache_fetch (start, cnt);
+      start = sector;
+      cnt = sector != HOLE;
+    }
+}
+
+/* Updates INODE's sequential access detection for a read of SIZE
+   bytes at OFFSET and queues read-ahead for the sectors following
+   the read when the access pattern is sequential.  Concurrent
+   readers may race on the window, which at worst costs a wasted
+   or missed read-ahead. */
+static void
+inode_readahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t first = offset / BLOCK_SECTOR_SIZE;
+  off_t last = (offset + size - 1) / BLOCK_SECTOR_SIZE;
+  off_t limit = bytes_to_sectors (inode_length (inode));
+  off_t end;
+
+  if (size <= 0)
+    return;
+
+  if (first == inode->ra_next)
+    inode->ra_window = inode->ra_window == 0 ? RA_MIN
+                       : inode->ra_window * 2 > RA_MAX ? RA_MAX
+                       : inode->ra_window * 2;
+  else 
+    {
+      inode->ra_window = 0;
+      inode->ra_end = 0;
+    }
+  inode->ra_next = (offset + size) / BLOCK_SECTOR_SIZE;
+
+  end = last + 1 + inode->ra_window;
+  if (end > limit)
+    end = limit;
+  inode_fetch (inode, last + 1 > inode->ra_end ? last + 1 : inode->ra_end,
+               end, true);
+  if (end > inode->ra_end)
+    inode->ra_end = end;
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -323,12 +1277,31 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  off_t end, fetched = 0;
+  uint8_t *block;
+
+  if (inode_is_mem (inode->sector))
+    return mem_read_at (inode, buffer, size, offset);
+
+  rwlock_acquire_read (&inode->rw);
+  if (inode->data.layout == LAYOUT_INLINE)
+    {
+      if (size > inode_length (inode) - offset)
+        size = inode_length (inode) - offset;
+      if (size > 0)
+        memcpy (buffer, inode->data.inline_data + offset, size);
+      rwlock_release_read (&inode->rw);
+      return size > 0 ? size : 0;
+    }
+
+  inode_readahead (inode, offset, size);
+  end = offset + size < inode_length (inode) ? offset + size
+                                             : inode_length (inode);
 
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset, false);
+      block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -341,23 +1314,33 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* Load the next few sectors this read spans in as few
+         requests as their layout allows, starting from the start
+         of their block so that whole blocks come in together. */
+      if (offset / BLOCK_SECTOR_SIZE >= fetched
+          && ((off_t) bytes_to_sectors (end) - offset / BLOCK_SECTOR_SIZE > 1
+              || free_map_block_sectors () > 1))
         {
-          /* Read full sector directly into caller's buffer. */
-          cache_read (sector_idx, buffer + bytes_read);
+          off_t first = ROUND_DOWN (offset, block_bytes ()) / BLOCK_SECTOR_SIZE;
+          fetched = offset / BLOCK_SECTOR_SIZE + FETCH_MAX;
+          if (fetched > (off_t) bytes_to_sectors (end))
+            fetched = bytes_to_sectors (end);
+          inode_fetch (inode, first, fetched, false);
         }
-      else 
+
+      /* Copy straight out of the cache block.  Holes read as
+         zeros, unless the data is still held back. */
+      if (sector_idx == HOLE)
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          cache_read (sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          if (inode_read_delayed (inode, buffer + bytes_read, chunk_size,
+                                  offset) != chunk_size)
+            memset (buffer + bytes_read, 0, chunk_size);
+        }
+      else
+        {
+          block = cache_get (sector_idx, CACHE_READ);
+          memcpy (buffer + bytes_read, block + sector_ofs, chunk_size);
+          cache_put (block);
         }
       
       /* Advance. */
@@ -365,31 +1348,78 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rw);
 
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
-off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+/* Writes SIZE bytes from BUFFER into disk inode INODE, starting
+   at OFFSET, for inode_write_at().  The bytes must lie within a
+   single L2 table's reach, which keeps the write small as a log
+   operation. */
+static off_t
+inode_write_piece (struct inode *inode, const uint8_t *buffer, off_t size,
+                   off_t offset)
 {
-  const uint8_t *buffer = buffer_;
-  off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  off_t bytes_written = 0, delayed = 0;
+  uint8_t *block;
+  bool exclusive = false, logged = false;
+  bool meta = inode_is_meta (inode);
+
+  /* Writes into blocks that already exist only need to keep the
+     layout still, so they share the lock.  Growing the file,
+     filling a hole, or touching inline data changes the inode
+     itself and needs it exclusively.  Only those, and writes to
+     metadata, change metadata, so only they are log operations;
+     the log must be entered before the lock. */
+  rwlock_acquire_read (&inode->rw);
+  if (size > 0 && (meta || inode->data.layout == LAYOUT_INLINE
+                   || !inode_mapped (inode, offset, offset + size)))
+    {
+      rwlock_release_read (&inode->rw);
+      log_begin ();
+      logged = true;
+      rwlock_acquire_read (&inode->rw);
+    }
+  if (size > 0 && (inode->data.layout == LAYOUT_INLINE
+                   || !inode_mapped (inode, offset, offset + size)))
+    {
+      rwlock_release_read (&inode->rw);
+      rwlock_acquire_write (&inode->rw);
+      exclusive = true;
+    }
 
   if (inode->deny_write_cnt)
-    return 0;
+    size = 0;
+
+  /* Appends wait in the delay buffer for their sectors.  Metadata
+     does not, so that it commits with the change that wrote it. */
+  if (exclusive && size > 0 && !meta)
+    {
+      delayed = inode_delay (inode, buffer, size, offset);
+      size -= delayed;
+    }
+
+  if (size > 0 && !inode_mapped (inode, offset, offset + size))
+    inode_allocate (inode, offset, offset + size);
+
+  if (inode->data.layout == LAYOUT_INLINE)
+    {
+      if (size > inode_length (inode) - offset)
+        size = inode_length (inode) - offset;
+      if (size > 0)
+        {
+          memcpy (inode->data.inline_data + offset, buffer, size);
+          log_write (inode->sector, &inode->data);
+          bytes_written = size;
+          size = 0;
+        }
+    }
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset, true);
+      block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -399,42 +1429,79 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
       /* Number of bytes to actually write into this sector. */
       int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      if (chunk_size <= 0 || sector_idx == HOLE)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          cache_write (sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
+      /* If the sector contains data before or after the chunk
+         we're writing, then we need to read in the sector
+         first.  Otherwise we start with a sector of all zeros. */
+      block = cache_get (sector_idx, sector_ofs > 0 || chunk_size < sector_left
+                                     ? CACHE_WRITE : CACHE_ZERO);
+      memcpy (block + sector_ofs, buffer + bytes_written, chunk_size);
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            cache_read (sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          cache_write ( sector_idx, bounce);
-        }
+      /* Directory entries and the free map are metadata; file data
+         is not logged. */
+      if (meta)
+        log_put (block);
+      else
+        cache_put (block);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
+  if (size == 0)
+    bytes_written += delayed;
+  if (bytes_written > 0)
+    {
+      /* Counted once the data is in, so that a defragmenter that
+         sees the count unchanged has copied it. */
+      lock_acquire (&inode->map_lock);
+      inode->writes++;
+      lock_release (&inode->map_lock);
+    }
+  if (exclusive)
+    rwlock_release_write (&inode->rw);
+  else
+    rwlock_release_read (&inode->rw);
+  if (logged)
+    log_end ();
+  return bytes_written;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if the inode cannot grow or an error occurs.
+   A write past end of file extends the inode, leaving a hole
+   between the old end and OFFSET.
+   The write is made a piece per L2 table, each its own log
+   operation. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+                off_t offset) 
+{
+  const uint8_t *buffer = buffer_;
+  off_t reach = TABLE_SIZE * block_bytes ();
+  off_t bytes_written = 0, piece, written;
+
+  if (inode_is_mem (inode->sector))
+    return mem_write_at (inode, buffer, size, offset);
+
+  while (size > 0)
+    {
+      piece = reach - offset % reach;
+      if (piece > size)
+        piece = size;
+      written = inode_write_piece (inode, buffer + bytes_written, piece,
+                                   offset);
+      bytes_written += written;
+      if (written < piece)
+        break;
+      size -= written;
+      offset += written;
+    }
   return bytes_written;
 }
 
@@ -443,8 +1510,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -453,9 +1522,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rw);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -472,11 +1543,318 @@ inode_is_dir (const struct inode *inode) {
 
 void
 inode_set_dir (struct inode* inode) {
+  rwlock_acquire_write (&inode->rw);
   inode->data.is_dir = true;
-  cache_write (inode->sector, &inode->data);
+  if (!inode_is_mem (inode->sector))
+    log_write (inode->sector, &inode->data);
+  rwlock_release_write (&inode->rw);
+}
+
+/* Returns the block size recorded in INODE, which must be the free
+   map's, as log2 of sectors per block. */
+unsigned
+inode_get_block_shift (const struct inode *inode)
+{
+  return inode->data.format & FORMAT_SHIFT;
+}
+
+/* Records SHIFT as the block size in INODE, the free map's, when
+   formatting, along with the disk having a log. */
+void
+inode_set_block_shift (struct inode *inode, unsigned shift)
+{
+  ASSERT (shift <= FORMAT_SHIFT);
+  rwlock_acquire_write (&inode->rw);
+  inode->data.format = shift | FORMAT_LOG;
+  log_write (inode->sector, &inode->data);
+  rwlock_release_write (&inode->rw);
+}
+
+/* Returns true if the file system was formatted with room for the
+   metadata log, as the free map's inode records.  Reads the disk
+   directly, since it is called before the log is replayed. */
+bool
+inode_disk_has_log (void)
+{
+  struct inode_disk d;
+
+  block_read (fs_device, FREE_MAP_SECTOR, &d);
+  return d.magic == INODE_MAGIC && (d.format & FORMAT_LOG) != 0;
 }
 
 int
 inode_get_open_cnt (struct inode* inode) {
   return inode->open_cnt;
-}
\ No newline at end of file
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (struct inode *inode)
+{
+  bool removed;
+
+  lock_acquire (&open_inodes_lock);
+  removed = inode->removed;
+  lock_release (&open_inodes_lock);
+  return removed;
+}
+
+/* Locks INODE for directory updates, so that a lookup and the
+   entry change it guards happen as one step.  When two are
+   needed, lock the parent before the child. */
+void
+inode_lock (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Releases the lock taken by inode_lock(). */
+void
+inode_unlock (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
+}
+
+/* Returns the name index the directory code keeps for INODE, or a
+   null pointer if there is none.  Must hold INODE's lock. */
+struct dir_index *
+inode_get_dir_index (struct inode *inode)
+{
+  ASSERT (lock_held_by_current_thread (&inode->dir_lock));
+  return inode->dir_index;
+}
+
+/* Sets INODE's name index to INDEX, which INODE destroys with
+   dir_index_destroy() when it is last closed.  Must hold INODE's
+   lock. */
+void
+inode_set_dir_index (struct inode *inode, struct dir_index *index)
+{
+  ASSERT (lock_held_by_current_thread (&inode->dir_lock));
+  inode->dir_index = index;
+}
+
+/* Moves INODE's data into a single run of free sectors if it is
+   spread over more than one, and maps it with one extent.  Leaves
+   inline and sparse files, files with held back data, and memory
+   inodes alone.
+   Returns true if the data was moved.
+
+   The data is copied under INODE's read lock, let go of between
+   batches, so that readers and writers are not held up for long,
+   and written out before the inode is switched over.  Only the
+   switch takes the write lock; it is called off if INODE was
+   written to meanwhile.  It is one log operation, so a crash
+   leaves the file at either its old or its new place.  The old
+   sectors are freed only after that. */
+bool
+inode_defrag (struct inode *inode)
+{
+  off_t spb = free_map_block_sectors ();
+  struct inode_disk old;
+  struct release_batch b;
+  uint8_t *from, *to;
+  block_sector_t start, sector, prev = HOLE;
+  off_t cnt, total, i;
+  unsigned writes;
+  int runs = 0;
+  bool moved = false;
+
+  rwlock_acquire_read (&inode->rw);
+  if (inode->removed || inode->delay_len > 0 || inode_is_mem (inode->sector)
+      || inode->data.layout == LAYOUT_INLINE)
+    goto unlock;
+  writes = inode->writes;
+
+  /* Count the runs the data is in. */
+  cnt = bytes_to_sectors (inode->data.length);
+  for (i = 0; i < cnt; i++)
+    {
+      sector = byte_to_sector (inode, i * BLOCK_SECTOR_SIZE);
+      if (sector == HOLE)
+        goto unlock;
+      if (i == 0 || sector != prev + 1)
+        runs++;
+      prev = sector;
+    }
+  total = ROUND_UP (cnt, spb);
+  if (runs <= 1 || !free_map_allocate_near (inode->sector, total, &start))
+    goto unlock;
+
+  /* Copy the data. */
+  for (i = 0; i < cnt; i++)
+    {
+      if (i % FETCH_MAX == 0 && i > 0)
+        {
+          rwlock_release_read (&inode->rw);
+          rwlock_acquire_read (&inode->rw);
+          if (inode->writes != writes)
+            {
+              rwlock_release_read (&inode->rw);
+              free_map_release (start, total);
+              return false;
+            }
+        }
+      if (i % FETCH_MAX == 0)
+        inode_fetch (inode, i, i + FETCH_MAX < cnt ? i + FETCH_MAX : cnt,
+                     false);
+      from = cache_get (byte_to_sector (inode, i * BLOCK_SECTOR_SIZE),
+                        CACHE_READ);
+      to = cache_get (start + i, CACHE_ZERO);
+      memcpy (to, from, BLOCK_SECTOR_SIZE);
+      cache_put (to);
+      cache_put (from);
+    }
+  rwlock_release_read (&inode->rw);
+
+  /* Zero the rest of the last block and get the copy to disk.
+     Nobody else knows of these sectors yet. */
+  for (; i < total; i++)
+    cache_put (cache_get (start + i, CACHE_ZERO));
+  for (i = 0; i < total; i++)
+    cache_sync (start + i);
+
+  /* Switch the inode over, unless it changed. */
+  log_begin ();
+  rwlock_acquire_write (&inode->rw);
+  if (!inode->removed && inode->delay_len == 0 && inode->writes == writes)
+    {
+      old = inode->data;
+      inode->data.layout = LAYOUT_EXTENTS;
+      inode->data.table = 0;
+      memset (inode->data.extents, 0, sizeof inode->data.extents);
+      inode->data.extents[0].start = start;
+      inode->data.extents[0].length = total;
+      inode->data.extent_cnt = 1;
+      inode->cursor = start + total;
+      inode_drop_tables (inode, 0, TABLE_SIZE - 1);
+      log_write (inode->sector, &inode->data);
+      moved = true;
+    }
+  rwlock_release_write (&inode->rw);
+  log_end ();
+
+  if (moved)
+    {
+      b.cnt = 0;
+      disk_release (&old, &b);
+      release_flush (&b);
+    }
+  else
+    free_map_release (start, total);
+  return moved;
+
+ unlock:
+  rwlock_release_read (&inode->rw);
+  return false;
+}
+
+/* Frees the sectors of every inode on reclaim_list, batching the
+   free map updates across inodes.  Must hold WORK_LOCK. */
+static void
+reclaim_all (void)
+{
+  struct release_batch b;
+  struct inode *inode;
+
+  ASSERT (lock_held_by_current_thread (&work_lock));
+
+  b.cnt = 0;
+  for (;;)
+    {
+      lock_acquire (&reclaim_lock);
+      inode = list_empty (&reclaim_list) ? NULL
+              : list_entry (list_pop_front (&reclaim_list), struct inode,
+                            reclaim_elem);
+      lock_release (&reclaim_lock);
+      if (inode == NULL)
+        break;
+
+      disk_release (&inode->data, &b);
+      release_add (&b, inode->sector, 1);
+      free (inode);
+    }
+  release_flush (&b);
+}
+
+/* Reclaimer thread. */
+static void
+inode_reclaimer (void *aux UNUSED)
+{
+  for (;;)
+    {
+      sema_down (&reclaim_sema);
+      lock_acquire (&work_lock);
+      reclaim_all ();
+      lock_release (&work_lock);
+    }
+}
+
+/* Gives the held back data of up to AGED_MAX open inodes, held
+   back for AGE ticks or longer, its sectors.  Each inode is a log
+   operation of its own.  Returns the number of inodes. */
+static size_t
+commit_delayed (int64_t age)
+{
+  struct inode *aged[AGED_MAX];
+  struct hash_iterator i;
+  size_t cnt = 0, k;
+
+  lock_acquire (&open_inodes_lock);
+  hash_first (&i, &open_inodes);
+  while (cnt < AGED_MAX && hash_next (&i))
+    {
+      struct inode *inode = hash_entry (hash_cur (&i), struct inode, elem);
+      if (inode->open_cnt > 0 && !inode->removed && inode->delay_len > 0
+          && timer_elapsed (inode->delay_since) >= age)
+        {
+          inode->open_cnt++;
+          aged[cnt++] = inode;
+        }
+    }
+  lock_release (&open_inodes_lock);
+
+  for (k = 0; k < cnt; k++)
+    {
+      log_begin ();
+      rwlock_acquire_write (&aged[k]->rw);
+      inode_commit (aged[k]);
+      rwlock_release_write (&aged[k]->rw);
+      log_end ();
+      inode_close (aged[k]);
+    }
+  return cnt;
+}
+
+/* Gives held back data older than DELAY_AGE its sectors, so that
+   a file kept open and appended to slowly does not keep it in
+   memory indefinitely.  This waits for the log and for inode
+   locks, so it has a thread of its own rather than holding up the
+   cache's write-behind. */
+static void
+delay_committer (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (DELAY_INTERVAL);
+      commit_delayed (DELAY_AGE);
+    }
+}
+
+/* Writes out data held back by inodes still open and frees the
+   sectors of every removed inode still waiting for the reclaimer.
+   Called before the free map is closed. */
+void
+inode_done (void)
+{
+  /* Inodes still open keep their held back data until now. */
+  while (commit_delayed (0) > 0)
+    continue;
+
+  lock_acquire (&work_lock);
+  reclaim_all ();
+  lock_release (&work_lock);
+
+  /* Let the freed sectors reach the free map while it is open. */
+  log_sync ();
+}
@@ -6,9 +6,13 @@
 #include "devices/block.h"
 
 struct bitmap;
+struct dir_index;
 
 void inode_init (void);
+void inode_done (void);
 bool inode_create (block_sector_t, off_t);
+bool inode_is_mem (block_sector_t);
+block_sector_t inode_alloc_mem (void);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
@@ -19,8 +23,17 @@ off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+bool inode_defrag (struct inode *);
 
 bool inode_is_dir (const struct inode *);
 void inode_set_dir (struct inode* );
+unsigned inode_get_block_shift (const struct inode *);
+void inode_set_block_shift (struct inode *, unsigned);
+bool inode_disk_has_log (void);
 int inode_get_open_cnt (struct inode* );
+bool inode_is_removed (struct inode *);
+void inode_lock (struct inode *);
+void inode_unlock (struct inode *);
+struct dir_index *inode_get_dir_index (struct inode *);
+void inode_set_dir_index (struct inode *, struct dir_index *);
 #endif /* filesys/inode.h */
@@ -0,0 +1,467 @@
+/* Metadata write-ahead log.
+
+   Operations that change file system metadata run between
+   log_begin() and log_end(), and write their metadata blocks with
+   log_put() or log_write() instead of cache_put() or
+   cache_write().  The blocks stay in the buffer cache, held there
+   so that they cannot reach their home sectors early.  Operations
+   join the running transaction until it is committed: once it has
+   LOG_BATCH blocks, or LOG_INTERVAL ticks after the last commit,
+   whichever comes first.  Committing waits for the operations in
+   the transaction to end, flushes the free map into it as well,
+   appends the whole transaction to the log with one write, and
+   rewrites the log header.  A crash loses the operations of the
+   running transaction, all of them.
+
+   An operation may add at most LOG_OP_MAX blocks, and is let in
+   only while the transaction has room for that many on top of
+   what the operations already in it may still add and of the free
+   map, so a transaction never outgrows the log.  Otherwise it
+   waits for the transaction to commit.
+
+   After the commit the blocks are free to be written home
+   whenever the cache gets to them.  Committed blocks stay in the
+   log until it has no room for the next transaction; only then is
+   it checkpointed, by writing home whatever the cache still has
+   dirty and emptying the log.  Mounting replays the log, so a
+   crash leaves the metadata as of the last commit.
+
+   File data is not logged.
+
+   Sectors freed by removing a file or moving its data stay in
+   use until the running transaction commits, since until then a
+   crash brings back whatever points to them.  Only then does the
+   log forget them and the free map get them back.
+
+   Disks formatted before the log have no room for it, so they are
+   run without one: operations write their blocks like any other. */
+
+#include "filesys/log.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Identifies a log header. */
+#define LOG_MAGIC 0x474f4c57
+
+/* A transaction is committed once it has LOG_BATCH blocks, which
+   leaves room for the operations still running in it, or after
+   LOG_INTERVAL ticks. */
+#define LOG_BATCH (LOG_BLOCKS / 2)
+#define LOG_INTERVAL TIMER_FREQ
+
+/* Most blocks a single operation may add to a transaction. */
+#define LOG_OP_MAX (LOG_BLOCKS - LOG_BATCH)
+
+/* An entry of a header's sector list that is to be skipped. */
+#define LOG_NONE ((block_sector_t) -1)
+
+/* On-disk log header, at LOG_SECTOR.  Log block I, at
+   LOG_SECTOR + 1 + I, is a copy of sector SECTORS[I].  Must be
+   exactly BLOCK_SECTOR_SIZE bytes long. */
+struct log_header
+  {
+    uint32_t magic;                     /* LOG_MAGIC. */
+    uint32_t cnt;                       /* Committed blocks. */
+    block_sector_t sectors[LOG_BLOCKS]; /* Home sector of each. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8 - LOG_BLOCKS * 4];
+  };
+
+static struct log_header header;        /* As on disk. */
+static block_sector_t txn[LOG_BLOCKS];  /* Running transaction's sectors. */
+static size_t txn_cnt;
+static int outstanding;                 /* Operations in the transaction. */
+static size_t reserved;                 /* Blocks they may still add. */
+static bool commit_wanted;              /* Commit when they end. */
+static bool committing;                 /* Transaction being committed. */
+static struct lock log_lock;            /* Guards all of the above. */
+static struct condition log_changed;    /* An operation or commit ended. */
+
+/* Sectors to free once the running transaction commits. */
+struct log_release
+  {
+    struct list_elem elem;              /* Element in release_list. */
+    size_t cnt;                         /* Number of runs. */
+    struct free_run runs[];             /* The runs. */
+  };
+static struct list release_list;        /* Guarded by log_lock. */
+
+static void log_committer (void *);
+
+static uint8_t log_data[LOG_BLOCKS][BLOCK_SECTOR_SIZE];
+static bool enabled;                    /* The disk has a log. */
+static size_t free_map_room;            /* Blocks kept for the free map. */
+
+/* Returns true if SECTOR is in the running transaction. */
+static bool
+in_txn (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < txn_cnt; i++)
+    if (txn[i] == sector)
+      return true;
+  return false;
+}
+
+/* Writes the header to disk. */
+static void
+write_header (void)
+{
+  block_write (fs_device, LOG_SECTOR, &header);
+}
+
+/* Initializes the log.  Unless FORMAT, first replays the blocks of
+   the last commits into their home sectors, which must happen
+   before anything else reads the disk.  A disk formatted without
+   a log is left alone. */
+void
+log_init (bool format)
+{
+  size_t i;
+
+  ASSERT (sizeof header == BLOCK_SECTOR_SIZE);
+  lock_init (&log_lock);
+  cond_init (&log_changed);
+  list_init (&release_list);
+  enabled = format || inode_disk_has_log ();
+  if (!enabled)
+    {
+      printf ("filesys: disk has no metadata log, running without it\n");
+      return;
+    }
+
+  /* The free map has a bit per block and blocks are at least a
+     sector, so this covers all of its sectors. */
+  free_map_room = DIV_ROUND_UP (block_size (fs_device),
+                                BLOCK_SECTOR_SIZE * 8);
+  if (free_map_room > LOG_OP_MAX)
+    {
+      printf ("filesys: disk too large for the metadata log, "
+              "running without it\n");
+      enabled = false;
+      return;
+    }
+
+  if (!format)
+    {
+      block_read (fs_device, LOG_SECTOR, &header);
+      if (header.magic == LOG_MAGIC && header.cnt <= LOG_BLOCKS)
+        for (i = 0; i < header.cnt; i++)
+          if (header.sectors[i] != LOG_NONE)
+            {
+              block_read (fs_device, LOG_SECTOR + 1 + i, log_data[0]);
+              block_write (fs_device, header.sectors[i], log_data[0]);
+            }
+    }
+  memset (&header, 0, sizeof header);
+  header.magic = LOG_MAGIC;
+  write_header ();
+  thread_create ("log_committer", PRI_DEFAULT, log_committer, NULL);
+}
+
+/* Writes home every block of the log that the cache has not, and
+   empties the log.  A block also in the running transaction is
+   held in the cache with changes not yet committed, so its
+   committed copy is written home from the log instead, in log
+   order so that the latest copy lands last. */
+static void
+checkpoint (void)
+{
+  size_t i;
+
+  for (i = 0; i < header.cnt; i++)
+    if (header.sectors[i] == LOG_NONE)
+      continue;
+    else if (in_txn (header.sectors[i]))
+      {
+        block_read (fs_device, LOG_SECTOR + 1 + i, log_data[0]);
+        block_write (fs_device, header.sectors[i], log_data[0]);
+      }
+    else
+      cache_sync (header.sectors[i]);
+  header.cnt = 0;
+  write_header ();
+}
+
+/* Appends the running transaction to the log and commits it.
+   Must hold log_lock, with no operation outstanding. */
+static void
+commit (void)
+{
+  void *bufs[LOG_BLOCKS];
+  size_t i;
+
+  if (txn_cnt == 0)
+    return;
+  if (header.cnt + txn_cnt > LOG_BLOCKS)
+    checkpoint ();
+
+  for (i = 0; i < txn_cnt; i++)
+    {
+      cache_read (txn[i], log_data[i]);
+      bufs[i] = log_data[i];
+    }
+  block_write_multi (fs_device, LOG_SECTOR + 1 + header.cnt, txn_cnt, bufs);
+  memcpy (header.sectors + header.cnt, txn, txn_cnt * sizeof *txn);
+  header.cnt += txn_cnt;
+  write_header ();
+
+  for (i = 0; i < txn_cnt; i++)
+    cache_unhold (txn[i]);
+  txn_cnt = 0;
+}
+
+/* Brings the free map up to date within the running transaction,
+   so that it commits together with what it allocated, and commits
+   it.  Then frees the sectors waiting for the commit.  Must hold
+   log_lock, with no operation outstanding. */
+static void
+commit_txn (void)
+{
+  struct thread *t = thread_current ();
+  struct list freed;
+
+  ASSERT (outstanding == 0);
+  committing = true;
+  lock_release (&log_lock);
+  t->log_depth++;
+  t->log_blocks = 0;
+  free_map_flush ();
+  t->log_depth--;
+  lock_acquire (&log_lock);
+  commit ();
+
+  /* The free map calls back into the log, so this is done without
+     log_lock. */
+  list_init (&freed);
+  while (!list_empty (&release_list))
+    list_push_back (&freed, list_pop_front (&release_list));
+  lock_release (&log_lock);
+  while (!list_empty (&freed))
+    {
+      struct log_release *r = list_entry (list_pop_front (&freed),
+                                          struct log_release, elem);
+      free_map_release_runs (r->runs, r->cnt);
+      free (r);
+    }
+  lock_acquire (&log_lock);
+  commit_wanted = committing = false;
+  cond_broadcast (&log_changed, &log_lock);
+}
+
+/* Returns true if the running transaction has room for one more
+   operation.  Must hold log_lock. */
+static bool
+has_room (void)
+{
+  return (!enabled
+          || txn_cnt + reserved + LOG_OP_MAX + free_map_room <= LOG_BLOCKS);
+}
+
+/* Starts an operation, joining the running transaction.  Waits
+   while it is being committed or waiting to be, or has no room
+   left; in that case it is committed once the operations in it
+   end.  Operations nest; only the outermost counts.  Must be
+   called before taking any lock that an operation may wait for. */
+void
+log_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->log_depth++ > 0)
+    return;
+  lock_acquire (&log_lock);
+  for (;;)
+    if (committing)
+      cond_wait (&log_changed, &log_lock);
+    else if (!commit_wanted && has_room ())
+      break;
+    else if (outstanding == 0)
+      commit_txn ();
+    else
+      {
+        commit_wanted = true;
+        cond_wait (&log_changed, &log_lock);
+      }
+  outstanding++;
+  if (enabled)
+    reserved += LOG_OP_MAX;
+  t->log_blocks = 0;
+  lock_release (&log_lock);
+}
+
+/* Ends an operation.  The last operation of a transaction to end
+   commits it, if it is big enough or a commit is wanted. */
+void
+log_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->log_depth > 0);
+  if (--t->log_depth > 0)
+    return;
+  lock_acquire (&log_lock);
+  if (enabled)
+    reserved -= LOG_OP_MAX - t->log_blocks;
+  if (--outstanding == 0 && (commit_wanted || txn_cnt >= LOG_BATCH))
+    commit_txn ();
+  else
+    cond_broadcast (&log_changed, &log_lock);
+  lock_release (&log_lock);
+}
+
+/* Commits the running transaction, after the operations in it
+   end.  Must not be called within an operation. */
+void
+log_sync (void)
+{
+  ASSERT (thread_current ()->log_depth == 0);
+  lock_acquire (&log_lock);
+  while (committing)
+    cond_wait (&log_changed, &log_lock);
+  if (outstanding == 0)
+    commit_txn ();
+  else
+    {
+      commit_wanted = true;
+      while (commit_wanted)
+        cond_wait (&log_changed, &log_lock);
+    }
+  lock_release (&log_lock);
+}
+
+/* Commits the running transaction every LOG_INTERVAL ticks. */
+static void
+log_committer (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (LOG_INTERVAL);
+      log_sync ();
+    }
+}
+
+/* Like cache_put(), but BLOCK, which must have been gotten for
+   writing, joins the running transaction.  Outside of an
+   operation this is just cache_put().  Once the transaction has
+   LOG_BATCH blocks, no more operations join it, so that it
+   commits when the ones in it end. */
+void
+log_put (void *block)
+{
+  struct thread *t = thread_current ();
+  block_sector_t sector;
+
+  if (enabled && t->log_depth > 0)
+    {
+      lock_acquire (&log_lock);
+      sector = cache_hold (block);
+      if (!in_txn (sector))
+        {
+          ASSERT (txn_cnt < LOG_BLOCKS);
+          txn[txn_cnt++] = sector;
+          if (!committing)
+            {
+              ASSERT (t->log_blocks < LOG_OP_MAX);
+              t->log_blocks++;
+              reserved--;
+            }
+          if (txn_cnt >= LOG_BATCH)
+            commit_wanted = true;
+        }
+      lock_release (&log_lock);
+    }
+  cache_put (block);
+}
+
+/* Like cache_write(), but the block joins the running
+   transaction. */
+void
+log_write (block_sector_t sector, const void *buffer)
+{
+  void *block = cache_get (sector, CACHE_ZERO);
+  memcpy (block, buffer, BLOCK_SECTOR_SIZE);
+  log_put (block);
+}
+
+/* Makes the log forget the CNT sectors starting at SECTOR, which
+   are being freed, so that replaying it cannot overwrite whatever
+   they are used for next. */
+void
+log_forget (block_sector_t sector, size_t cnt)
+{
+  bool changed = false;
+  size_t i;
+
+  if (!enabled)
+    return;
+  lock_acquire (&log_lock);
+  for (i = 0; i < txn_cnt; )
+    if (txn[i] - sector < cnt)
+      {
+        cache_unhold (txn[i]);
+        txn[i] = txn[--txn_cnt];
+      }
+    else
+      i++;
+  for (i = 0; i < header.cnt; i++)
+    if (header.sectors[i] - sector < cnt)
+      {
+        header.sectors[i] = LOG_NONE;
+        changed = true;
+      }
+  if (changed)
+    write_header ();
+  lock_release (&log_lock);
+}
+
+/* Frees the CNT runs in RUNS, which the disk may still refer to,
+   once the running transaction commits.  Without a log, or if
+   memory is short, they are freed right away, the latter after a
+   commit if possible. */
+void
+log_release (const struct free_run *runs, size_t cnt)
+{
+  struct log_release *r;
+
+  if (cnt == 0)
+    return;
+  r = enabled ? malloc (sizeof *r + cnt * sizeof *runs) : NULL;
+  if (r == NULL)
+    {
+      if (enabled && thread_current ()->log_depth == 0)
+        log_sync ();
+      free_map_release_runs (runs, cnt);
+      return;
+    }
+  r->cnt = cnt;
+  memcpy (r->runs, runs, cnt * sizeof *runs);
+  lock_acquire (&log_lock);
+  list_push_back (&release_list, &r->elem);
+  lock_release (&log_lock);
+}
+
+/* Commits the running transaction and checkpoints the log.  Called
+   once every operation has ended. */
+void
+log_done (void)
+{
+  log_sync ();
+  lock_acquire (&log_lock);
+  ASSERT (outstanding == 0);
+  if (enabled)
+    checkpoint ();
+  lock_release (&log_lock);
+}
@@ -0,0 +1,25 @@
+#ifndef FILESYS_LOG_H
+#define FILESYS_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+struct free_run;
+
+/* Sectors taken by the log, starting at LOG_SECTOR: a header and
+   the logged blocks. */
+#define LOG_BLOCKS 32
+#define LOG_SECTORS (1 + LOG_BLOCKS)
+
+void log_init (bool format);
+void log_begin (void);
+void log_end (void);
+void log_sync (void);
+void log_put (void *block);
+void log_write (block_sector_t sector, const void *buffer);
+void log_forget (block_sector_t sector, size_t cnt);
+void log_release (const struct free_run *runs, size_t cnt);
+void log_done (void);
+
+#endif /* filesys/log.h */
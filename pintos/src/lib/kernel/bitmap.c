@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -23,11 +24,16 @@ typedef unsigned long elem_type;
 
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   FULL summarizes BITS: bit K of FULL is set exactly when element
+   K of BITS has every bit set, so that searches for unset bits can
+   skip ELEM_BITS full elements at a time. */
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    elem_type *full;    /* One bit per element of BITS. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -60,6 +66,14 @@ byte_cnt (size_t bit_cnt)
   return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Returns the number of bytes required for the summary of a
+   bitmap with BIT_CNT bits. */
+static inline size_t
+full_byte_cnt (size_t bit_cnt)
+{
+  return byte_cnt (elem_cnt (bit_cnt));
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -68,7 +82,67 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
-
+
+/* Returns the index of the lowest set bit in W, which must not
+   be zero. */
+static inline size_t
+first_set (elem_type w)
+{
+  return __builtin_ctzl (w);
+}
+
+/* Returns the number of set bits in W. */
+static inline size_t
+set_cnt (elem_type w)
+{
+  size_t cnt = 0;
+  for (; w != 0; w &= w - 1)
+    cnt++;
+  return cnt;
+}
+
+/* Returns a mask of the bits in an element from bit FIRST up to,
+   but not including, bit FIRST + CNT. */
+static inline elem_type
+range_mask (size_t first, size_t cnt)
+{
+  elem_type mask = cnt < ELEM_BITS ? ((elem_type) 1 << cnt) - 1
+                                   : (elem_type) -1;
+  return mask << first;
+}
+
+/* Brings the summary bit for element IDX of B up to date. */
+static inline void
+update_full (struct bitmap *b, size_t idx)
+{
+  if (b->bits[idx] == (elem_type) -1)
+    b->full[elem_idx (idx)] |= bit_mask (idx);
+  else
+    b->full[elem_idx (idx)] &= ~bit_mask (idx);
+}
+
+/* Sets the bits in MASK of element IDX of B to VALUE and updates
+   the summary.  Interrupts are turned off so that the element and
+   its summary bit change together. */
+static void
+set_bits (struct bitmap *b, size_t idx, elem_type mask, bool value)
+{
+  enum intr_level old_level = intr_disable ();
+  if (value)
+    b->bits[idx] |= mask;
+  else
+    b->bits[idx] &= ~mask;
+  update_full (b, idx);
+  intr_set_level (old_level);
+}
+
+/* Returns the bits of element IDX of B that are set to VALUE. */
+static inline elem_type
+matching_bits (const struct bitmap *b, size_t idx, bool value)
+{
+  return value ? b->bits[idx] : ~b->bits[idx];
+}
+
 /* Creation and destruction. */
 
 /* Creates and returns a pointer to a newly allocated bitmap with room for
@@ -83,11 +157,14 @@ bitmap_create (size_t bit_cnt)
     {
       b->bit_cnt = bit_cnt;
       b->bits = malloc (byte_cnt (bit_cnt));
-      if (b->bits != NULL || bit_cnt == 0)
+      b->full = malloc (full_byte_cnt (bit_cnt));
+      if ((b->bits != NULL && b->full != NULL) || bit_cnt == 0)
         {
           bitmap_set_all (b, false);
           return b;
         }
+      free (b->bits);
+      free (b->full);
       free (b);
     }
   return NULL;
@@ -105,6 +182,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->full = b->bits + elem_cnt (bit_cnt);
   bitmap_set_all (b, false);
   return b;
 }
@@ -114,7 +192,8 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 size_t
 bitmap_buf_size (size_t bit_cnt) 
 {
-  return sizeof (struct bitmap) + byte_cnt (bit_cnt);
+  return sizeof (struct bitmap) + byte_cnt (bit_cnt)
+         + full_byte_cnt (bit_cnt);
 }
 
 /* Destroys bitmap B, freeing its storage.
@@ -125,10 +204,11 @@ bitmap_destroy (struct bitmap *b)
   if (b != NULL) 
     {
       free (b->bits);
+      free (b->full);
       free (b);
     }
 }
-
+
 /* Bitmap size. */
 
 /* Returns the number of bits in B. */
@@ -137,7 +217,7 @@ bitmap_size (const struct bitmap *b)
 {
   return b->bit_cnt;
 }
-
+
 /* Setting and testing single bits. */
 
 /* Atomically sets the bit numbered IDX in B to VALUE. */
@@ -156,26 +236,14 @@ bitmap_set (struct bitmap *b, size_t idx, bool value)
 void
 bitmap_mark (struct bitmap *b, size_t bit_idx) 
 {
-  size_t idx = elem_idx (bit_idx);
-  elem_type mask = bit_mask (bit_idx);
-
-  /* This is equivalent to `b->bits[idx] |= mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the OR instruction in [IA32-v2b]. */
-  asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  set_bits (b, elem_idx (bit_idx), bit_mask (bit_idx), true);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
 void
 bitmap_reset (struct bitmap *b, size_t bit_idx) 
 {
-  size_t idx = elem_idx (bit_idx);
-  elem_type mask = bit_mask (bit_idx);
-
-  /* This is equivalent to `b->bits[idx] &= ~mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the AND instruction in [IA32-v2a]. */
-  asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  set_bits (b, elem_idx (bit_idx), bit_mask (bit_idx), false);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -185,12 +253,10 @@ void
 bitmap_flip (struct bitmap *b, size_t bit_idx) 
 {
   size_t idx = elem_idx (bit_idx);
-  elem_type mask = bit_mask (bit_idx);
-
-  /* This is equivalent to `b->bits[idx] ^= mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the XOR instruction in [IA32-v2b]. */
-  asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  enum intr_level old_level = intr_disable ();
+  b->bits[idx] ^= bit_mask (bit_idx);
+  update_full (b, idx);
+  intr_set_level (old_level);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -201,7 +267,7 @@ bitmap_test (const struct bitmap *b, size_t idx)
   ASSERT (idx < b->bit_cnt);
   return (b->bits[elem_idx (idx)] & bit_mask (idx)) != 0;
 }
-
+
 /* Setting and testing multiple bits. */
 
 /* Sets all bits in B to VALUE. */
@@ -213,18 +279,25 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE, one element
+   at a time. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t end = start + cnt, n;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  for (; start < end; start += n)
+    {
+      n = ELEM_BITS - start % ELEM_BITS;
+      if (n > end - start)
+        n = end - start;
+      set_bits (b, elem_idx (start), range_mask (start % ELEM_BITS, n),
+                value);
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,16 +305,21 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t end = start + cnt, n, value_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  for (; start < end; start += n)
+    {
+      n = ELEM_BITS - start % ELEM_BITS;
+      if (n > end - start)
+        n = end - start;
+      value_cnt += set_cnt (matching_bits (b, elem_idx (start), value)
+                            & range_mask (start % ELEM_BITS, n));
+    }
   return value_cnt;
 }
 
@@ -250,15 +328,21 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t end = start + cnt, n;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
+  for (; start < end; start += n)
+    {
+      n = ELEM_BITS - start % ELEM_BITS;
+      if (n > end - start)
+        n = end - start;
+      if (matching_bits (b, elem_idx (start), value)
+          & range_mask (start % ELEM_BITS, n))
+        return true;
+    }
   return false;
 }
 
@@ -285,26 +369,79 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 {
   return !bitmap_contains (b, start, cnt, false);
 }
-
+
 /* Finding set or unset bits. */
 
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Runs are followed an element at a time, with the lowest set
+   bit finding where each run starts and ends.  When looking for
+   unset bits, full elements are skipped through the summary,
+   ELEM_BITS of them per summary element. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  size_t i = start, run_start = 0, run_len = 0;
+
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt == 0)
+    return start;
+  while (i < b->bit_cnt)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t idx = elem_idx (i);
+      size_t avail = ELEM_BITS - i % ELEM_BITS, len;
+      elem_type w, ones;
+
+      if (!value)
+        {
+          /* Not-full elements from IDX up to the end of its
+             summary element. */
+          elem_type room = ~b->full[elem_idx (idx)] >> (idx % ELEM_BITS);
+          if (!(room & 1))
+            {
+              run_len = 0;
+              if (room == 0)
+                i = (elem_idx (idx) + 1) * ELEM_BITS * ELEM_BITS;
+              else
+                i = (idx + first_set (room)) * ELEM_BITS;
+              continue;
+            }
+        }
+
+      w = matching_bits (b, idx, value) >> (i % ELEM_BITS);
+      if (run_len == 0)
+        {
+          size_t skip;
+          if (w == 0)
+            {
+              i += avail;
+              continue;
+            }
+          skip = first_set (w);
+          w >>= skip;
+          avail -= skip;
+          i += skip;
+          run_start = i;
+        }
+
+      /* Extend the run by the bits set to VALUE that W starts
+         with.  A run that stops short of the element's end is
+         over. */
+      ones = ~w;
+      len = ones == 0 ? avail : first_set (ones);
+      if (len > avail)
+        len = avail;
+      run_len += len;
+      i += len;
+      if (run_len >= cnt)
+        return run_start + cnt <= b->bit_cnt ? run_start : BITMAP_ERROR;
+      if (len < avail)
+        run_len = 0;
     }
   return BITMAP_ERROR;
 }
@@ -344,8 +481,11 @@ bitmap_read (struct bitmap *b, struct file *file)
   if (b->bit_cnt > 0) 
     {
       off_t size = byte_cnt (b->bit_cnt);
+      size_t i;
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+        update_full (b, i);
     }
   return success;
 }
@@ -358,6 +498,22 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes of B starting at byte OFS to the same
+   place in FILE, clipped to the end of B.  Return true if
+   successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t ofs, size_t size)
+{
+  size_t total = byte_cnt (b->bit_cnt);
+  if (ofs >= total)
+    return true;
+  if (size > total - ofs)
+    size = total - ofs;
+  return file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+         == (off_t) size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -15,6 +15,19 @@ typedef int mapid_t;
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
+/* Buffer cache counters reported by cache_stats(). */
+struct cache_stats
+  {
+    unsigned long long hits;            /* Lookups found in the cache. */
+    unsigned long long misses;          /* Lookups that had to load. */
+    unsigned long long evictions;       /* Blocks evicted for reuse. */
+    unsigned long long writebacks;      /* Dirty blocks written to disk. */
+    unsigned long long ra_reads;        /* Blocks loaded by read-ahead. */
+    unsigned long long ra_hits;         /* Read-ahead blocks later used. */
+    unsigned long long lock_waits;      /* Contended cache lock acquires. */
+    unsigned long long lock_wait_ticks; /* Timer ticks spent waiting. */
+  };
+
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
@@ -44,5 +57,6 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+bool cache_stats (struct cache_stats *);
 
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,48 @@
+/* Reads the buffer cache counters before and after writing a
+   file and reading it back twice, and checks that none of them
+   went down and that the second reads hit the cache.  Then passes
+   a kernel address, which must kill the process. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 4096
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "cached";
+  struct cache_stats before, after;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (!cache_stats (NULL), "cache_stats (NULL)");
+  CHECK (cache_stats (&before), "cache_stats");
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == FILE_SIZE, "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+  check_file (file_name, buf, sizeof buf);
+
+  CHECK (cache_stats (&after), "cache_stats");
+  if (after.hits < before.hits || after.misses < before.misses
+      || after.evictions < before.evictions
+      || after.writebacks < before.writebacks
+      || after.ra_reads < before.ra_reads || after.ra_hits < before.ra_hits
+      || after.lock_waits < before.lock_waits
+      || after.lock_wait_ticks < before.lock_wait_ticks)
+    fail ("a counter went down");
+  CHECK (after.hits >= before.hits + FILE_SIZE / 512,
+         "reads hit the cache");
+
+  cache_stats ((struct cache_stats *) 0xc0000000);
+  fail ("should have exited with -1");
+}
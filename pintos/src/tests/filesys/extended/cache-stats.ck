@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(cache-stats) begin
+(cache-stats) cache_stats (NULL)
+(cache-stats) cache_stats
+(cache-stats) create "cached"
+(cache-stats) open "cached"
+(cache-stats) write "cached"
+(cache-stats) close "cached"
+(cache-stats) open "cached" for verification
+(cache-stats) verified contents of "cached"
+(cache-stats) close "cached"
+(cache-stats) open "cached" for verification
+(cache-stats) verified contents of "cached"
+(cache-stats) close "cached"
+(cache-stats) cache_stats
+(cache-stats) reads hit the cache
+cache-stats: exit(-1)
+EOF
+pass;
@@ -0,0 +1,114 @@
+/* Creates hundreds of files in one directory, looks each of them
+   up and lists the directory, then removes every other file and
+   creates one of them again, checking lookups and the listing
+   after each step. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 300
+
+static bool
+all (size_t i UNUSED)
+{
+  return true;
+}
+
+static bool
+even (size_t i)
+{
+  return i % 2 == 0;
+}
+
+static bool
+even_or_one (size_t i)
+{
+  return i % 2 == 0 || i == 1;
+}
+
+/* Returns the name of file I in "big", in a static buffer. */
+static const char *
+file_name (size_t i)
+{
+  static char name[32];
+  snprintf (name, sizeof name, "big/f%zu", i);
+  return name;
+}
+
+/* Checks that file I of "big" can be opened exactly when
+   WANTED (I) is true. */
+static void
+check_lookups (bool (*wanted) (size_t))
+{
+  size_t i;
+  int fd;
+
+  msg ("look up %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      fd = open (file_name (i));
+      if ((fd > 1) != wanted (i))
+        fail ("open \"%s\" %s", file_name (i),
+              fd > 1 ? "succeeded" : "failed");
+      if (fd > 1)
+        close (fd);
+    }
+}
+
+/* Checks that "big" lists file I, once, exactly when WANTED (I)
+   is true. */
+static void
+check_listing (bool (*wanted) (size_t))
+{
+  static bool seen[FILE_CNT];
+  char name[READDIR_MAX_LEN + 1];
+  size_t i, cnt = 0;
+  int fd;
+
+  CHECK ((fd = open ("big")) > 1, "open \"big\"");
+  memset (seen, 0, sizeof seen);
+  while (readdir (fd, name))
+    {
+      i = atoi (name + 1);
+      if (name[0] != 'f' || i >= FILE_CNT || strcmp (file_name (i) + 4, name)
+          || !wanted (i) || seen[i])
+        fail ("readdir listed unexpected \"%s\"", name);
+      seen[i] = true;
+      cnt++;
+    }
+  for (i = 0; i < FILE_CNT; i++)
+    if (wanted (i) && !seen[i])
+      fail ("readdir did not list \"f%zu\"", i);
+  msg ("readdir listed %zu files", cnt);
+  msg ("close \"big\"");
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  size_t i;
+
+  CHECK (mkdir ("big"), "mkdir \"big\"");
+  msg ("create %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    if (!create (file_name (i), 0))
+      fail ("create \"%s\"", file_name (i));
+  check_lookups (all);
+  check_listing (all);
+
+  msg ("remove every other file");
+  for (i = 1; i < FILE_CNT; i += 2)
+    if (!remove (file_name (i)))
+      fail ("remove \"%s\"", file_name (i));
+  check_lookups (even);
+  check_listing (even);
+
+  CHECK (create ("big/f1", 0), "create \"big/f1\"");
+  check_lookups (even_or_one);
+  check_listing (even_or_one);
+}
@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-large) begin
+(dir-large) mkdir "big"
+(dir-large) create 300 files
+(dir-large) look up 300 files
+(dir-large) open "big"
+(dir-large) readdir listed 300 files
+(dir-large) close "big"
+(dir-large) remove every other file
+(dir-large) look up 300 files
+(dir-large) open "big"
+(dir-large) readdir listed 150 files
+(dir-large) close "big"
+(dir-large) create "big/f1"
+(dir-large) look up 300 files
+(dir-large) open "big"
+(dir-large) readdir listed 151 files
+(dir-large) close "big"
+(dir-large) end
+EOF
+pass;
@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($data) = random_bytes (40000);
+substr ($data, 1000, 20000) = random_bytes (20000);
+check_archive ({"big-io" => [$data]});
+pass;
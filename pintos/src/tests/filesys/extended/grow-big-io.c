@@ -0,0 +1,54 @@
+/* Writes and reads a file in single calls that span many sectors,
+   at offsets that do not start or end on a sector boundary, and
+   checks the data each way. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 40000
+static char data[FILE_SIZE];
+static char patch[20000];
+static char buf[FILE_SIZE];
+static const char *file_name = "big-io";
+
+/* Reads SIZE bytes at OFS from FD in one call and compares them
+   with EXPECTED + OFS. */
+static void
+read_all (int fd, const char *expected, size_t ofs, size_t size)
+{
+  seek (fd, ofs);
+  CHECK (read (fd, buf, size) == (int) size,
+         "read %zu bytes at offset %zu", size, ofs);
+  compare_bytes (buf, expected + ofs, size, ofs, file_name);
+}
+
+void
+test_main (void) 
+{
+  int fd;
+
+  random_init (0);
+  random_bytes (data, sizeof data);
+  random_bytes (patch, sizeof patch);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, data, sizeof data) == FILE_SIZE,
+         "write %d bytes at offset 0", FILE_SIZE);
+  read_all (fd, data, 0, FILE_SIZE);
+  read_all (fd, data, 777, 30000);
+
+  seek (fd, 1000);
+  CHECK (write (fd, patch, sizeof patch) == sizeof patch,
+         "write %zu bytes at offset 1000", sizeof patch);
+  memcpy (data + 1000, patch, sizeof patch);
+  read_all (fd, data, 0, FILE_SIZE);
+  read_all (fd, data, 999, 20002);
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, data, sizeof data);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-big-io) begin
+(grow-big-io) create "big-io"
+(grow-big-io) open "big-io"
+(grow-big-io) write 40000 bytes at offset 0
+(grow-big-io) read 40000 bytes at offset 0
+(grow-big-io) read 30000 bytes at offset 777
+(grow-big-io) write 20000 bytes at offset 1000
+(grow-big-io) read 40000 bytes at offset 0
+(grow-big-io) read 20002 bytes at offset 999
+(grow-big-io) close "big-io"
+(grow-big-io) open "big-io" for verification
+(grow-big-io) verified contents of "big-io"
+(grow-big-io) close "big-io"
+(grow-big-io) end
+EOF
+pass;
@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($data) = random_bytes (20000);
+substr ($data, 50, 100) = random_bytes (100);
+check_archive ({"delay" => [$data]});
+pass;
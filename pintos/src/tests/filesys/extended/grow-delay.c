@@ -0,0 +1,61 @@
+/* Appends to a file in small writes, which are held back before
+   they get sectors, and reads it through another handle while
+   they are, after overwriting part of the held back data, and
+   once the appends have outgrown what can be held back. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 20000
+#define APPEND_SIZE 100
+static char data[FILE_SIZE];
+static char patch[APPEND_SIZE];
+static const char *file_name = "delay";
+
+/* Appends the bytes of DATA from *OFS up to END to FD, a few at
+   a time. */
+static void
+append (int fd, size_t *ofs, size_t end)
+{
+  msg ("append %zu bytes", end - *ofs);
+  for (; *ofs < end; *ofs += APPEND_SIZE)
+    if (write (fd, data + *ofs, APPEND_SIZE) != APPEND_SIZE)
+      fail ("write %d bytes at offset %zu", APPEND_SIZE, *ofs);
+}
+
+void
+test_main (void) 
+{
+  size_t ofs = 0;
+  int fd;
+
+  random_init (0);
+  random_bytes (data, sizeof data);
+  random_bytes (patch, sizeof patch);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  append (fd, &ofs, 2000);
+  check_file (file_name, data, ofs);
+  append (fd, &ofs, 8000);
+  check_file (file_name, data, ofs);
+
+  seek (fd, 50);
+  CHECK (write (fd, patch, sizeof patch) == sizeof patch,
+         "write %zu bytes at offset 50", sizeof patch);
+  memcpy (data + 50, patch, sizeof patch);
+  check_file (file_name, data, ofs);
+
+  seek (fd, ofs);
+  append (fd, &ofs, FILE_SIZE);
+  CHECK (tell (fd) == FILE_SIZE, "tell \"%s\"", file_name);
+  check_file (file_name, data, ofs);
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, data, sizeof data);
+}
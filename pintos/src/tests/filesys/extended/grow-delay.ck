@@ -0,0 +1,32 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-delay) begin
+(grow-delay) create "delay"
+(grow-delay) open "delay"
+(grow-delay) append 2000 bytes
+(grow-delay) open "delay" for verification
+(grow-delay) verified contents of "delay"
+(grow-delay) close "delay"
+(grow-delay) append 6000 bytes
+(grow-delay) open "delay" for verification
+(grow-delay) verified contents of "delay"
+(grow-delay) close "delay"
+(grow-delay) write 100 bytes at offset 50
+(grow-delay) open "delay" for verification
+(grow-delay) verified contents of "delay"
+(grow-delay) close "delay"
+(grow-delay) append 12000 bytes
+(grow-delay) tell "delay"
+(grow-delay) open "delay" for verification
+(grow-delay) verified contents of "delay"
+(grow-delay) close "delay"
+(grow-delay) close "delay"
+(grow-delay) open "delay" for verification
+(grow-delay) verified contents of "delay"
+(grow-delay) close "delay"
+(grow-delay) end
+EOF
+pass;
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($size) = 39 * 9216 + 512;
+my ($data) = random_bytes ($size);
+my ($extents) = "\0" x $size;
+foreach my $ofs ((map ($_ * 9216, 0...39)),
+                 (map ($_ * 9216 + 4608, grep ($_ % 2 == 0, 0...38)))) {
+    substr ($extents, $ofs, 512) = substr ($data, $ofs, 512);
+}
+check_archive ({"extents" => [$extents]});
+pass;
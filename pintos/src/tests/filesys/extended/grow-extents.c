@@ -0,0 +1,54 @@
+/* Writes 40 pieces of a file 9 kB apart, so that each one is
+   separated from the last by a hole and the file needs more runs
+   than its inode has extents for.  Then fills in half of the
+   holes, checking the contents after each pass. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PIECE_CNT 40
+#define STRIDE 9216
+#define PIECE_SIZE 512
+#define FILE_SIZE ((PIECE_CNT - 1) * STRIDE + PIECE_SIZE)
+static char data[FILE_SIZE];
+static char buf[FILE_SIZE];
+
+/* Writes the PIECE_SIZE bytes of DATA at OFS to FD, and to BUF. */
+static void
+write_piece (int fd, size_t ofs)
+{
+  seek (fd, ofs);
+  if (write (fd, data + ofs, PIECE_SIZE) != PIECE_SIZE)
+    fail ("write %d bytes at offset %zu", PIECE_SIZE, ofs);
+  memcpy (buf + ofs, data + ofs, PIECE_SIZE);
+}
+
+void
+test_main (void) 
+{
+  const char *file_name = "extents";
+  size_t i;
+  int fd;
+
+  random_init (0);
+  random_bytes (data, sizeof data);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  msg ("write %d pieces %d bytes apart", PIECE_CNT, STRIDE);
+  for (i = 0; i < PIECE_CNT; i++)
+    write_piece (fd, i * STRIDE);
+  check_file (file_name, buf, sizeof buf);
+
+  msg ("fill in every other hole");
+  for (i = 0; i < PIECE_CNT - 1; i += 2)
+    write_piece (fd, i * STRIDE + STRIDE / 2);
+  check_file (file_name, buf, sizeof buf);
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
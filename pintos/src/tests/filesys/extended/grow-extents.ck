@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-extents) begin
+(grow-extents) create "extents"
+(grow-extents) open "extents"
+(grow-extents) write 40 pieces 9216 bytes apart
+(grow-extents) open "extents" for verification
+(grow-extents) verified contents of "extents"
+(grow-extents) close "extents"
+(grow-extents) fill in every other hole
+(grow-extents) open "extents" for verification
+(grow-extents) verified contents of "extents"
+(grow-extents) close "extents"
+(grow-extents) close "extents"
+(grow-extents) end
+EOF
+pass;
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($data) = random_bytes (70100);
+my ($holes) = "\0" x 70100;
+substr ($holes, $_->[0], $_->[1]) = substr ($data, $_->[0], $_->[1])
+  foreach [70000, 100], [0, 100], [20000, 512], [33000, 1];
+check_archive ({"holes" => [$holes]});
+pass;
@@ -0,0 +1,46 @@
+/* Writes pieces of a file far apart, leaving holes between them,
+   and checks that the holes read back as zeros, before and after
+   one of them is partly filled in. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 70100
+static char data[FILE_SIZE];
+static char buf[FILE_SIZE];
+
+/* Writes the SIZE bytes of DATA at OFS to FD, and to BUF. */
+static void
+write_piece (int fd, size_t ofs, size_t size)
+{
+  seek (fd, ofs);
+  CHECK (write (fd, data + ofs, size) == (int) size,
+         "write %zu bytes at offset %zu", size, ofs);
+  memcpy (buf + ofs, data + ofs, size);
+}
+
+void
+test_main (void) 
+{
+  const char *file_name = "holes";
+  int fd;
+
+  random_init (0);
+  random_bytes (data, sizeof data);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  write_piece (fd, 70000, 100);
+  write_piece (fd, 0, 100);
+  check_file (file_name, buf, sizeof buf);
+
+  write_piece (fd, 20000, 512);
+  write_piece (fd, 33000, 1);
+  check_file (file_name, buf, sizeof buf);
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
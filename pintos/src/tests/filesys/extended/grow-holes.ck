@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-holes) begin
+(grow-holes) create "holes"
+(grow-holes) open "holes"
+(grow-holes) write 100 bytes at offset 70000
+(grow-holes) write 100 bytes at offset 0
+(grow-holes) open "holes" for verification
+(grow-holes) verified contents of "holes"
+(grow-holes) close "holes"
+(grow-holes) write 512 bytes at offset 20000
+(grow-holes) write 1 bytes at offset 33000
+(grow-holes) open "holes" for verification
+(grow-holes) verified contents of "holes"
+(grow-holes) close "holes"
+(grow-holes) close "holes"
+(grow-holes) end
+EOF
+pass;
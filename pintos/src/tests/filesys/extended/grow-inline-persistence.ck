@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_archive ({"inline" => [random_bytes (1500)],
+                "small" => ["\0" x 496],
+                "big" => ["\0" x 497]});
+pass;
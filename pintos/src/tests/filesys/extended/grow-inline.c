@@ -0,0 +1,42 @@
+/* Grows a file across the 496 bytes that fit in its inode, so
+   that its data moves out to a sector of its own, checking the
+   contents on either side of the move.  Also creates files just
+   small enough and just too large to start out inline. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 1500
+static char buf[FILE_SIZE];
+static char zeros[497];
+
+void
+test_main (void) 
+{
+  static const size_t steps[] = {495, 1, 1, 300, FILE_SIZE - 797};
+  const char *file_name = "inline";
+  size_t ofs = 0, i;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("small", 496), "create \"small\"");
+  CHECK (create ("big", 497), "create \"big\"");
+  check_file ("small", zeros, 496);
+  check_file ("big", zeros, 497);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (i = 0; i < sizeof steps / sizeof *steps; i++)
+    {
+      CHECK (write (fd, buf + ofs, steps[i]) == (int) steps[i],
+             "write %zu bytes at offset %zu", steps[i], ofs);
+      ofs += steps[i];
+      check_file (file_name, buf, ofs);
+    }
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
@@ -0,0 +1,40 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-inline) begin
+(grow-inline) create "small"
+(grow-inline) create "big"
+(grow-inline) open "small" for verification
+(grow-inline) verified contents of "small"
+(grow-inline) close "small"
+(grow-inline) open "big" for verification
+(grow-inline) verified contents of "big"
+(grow-inline) close "big"
+(grow-inline) create "inline"
+(grow-inline) open "inline"
+(grow-inline) write 495 bytes at offset 0
+(grow-inline) open "inline" for verification
+(grow-inline) verified contents of "inline"
+(grow-inline) close "inline"
+(grow-inline) write 1 bytes at offset 495
+(grow-inline) open "inline" for verification
+(grow-inline) verified contents of "inline"
+(grow-inline) close "inline"
+(grow-inline) write 1 bytes at offset 496
+(grow-inline) open "inline" for verification
+(grow-inline) verified contents of "inline"
+(grow-inline) close "inline"
+(grow-inline) write 300 bytes at offset 497
+(grow-inline) open "inline" for verification
+(grow-inline) verified contents of "inline"
+(grow-inline) close "inline"
+(grow-inline) write 703 bytes at offset 797
+(grow-inline) open "inline" for verification
+(grow-inline) verified contents of "inline"
+(grow-inline) close "inline"
+(grow-inline) close "inline"
+(grow-inline) end
+EOF
+pass;
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($fs);
+foreach my $i (0...39) {
+    my ($data) = random_bytes (600);
+    $fs->{"d$i"} = {"f" => [$data]} if $i % 2 == 0;
+}
+check_archive ($fs);
+pass;
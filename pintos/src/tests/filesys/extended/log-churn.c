@@ -0,0 +1,64 @@
+/* Makes and removes directories and files for many more metadata
+   operations than the log holds at once, so that it commits
+   repeatedly, then checks what is left.  The persistence check
+   looks for the same tree after the file system is mounted
+   again. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DIR_CNT 40
+#define FILE_SIZE 600
+#define TMP_SIZE 1000
+static char bufs[DIR_CNT][FILE_SIZE];
+
+void
+test_main (void) 
+{
+  char name[32];
+  size_t i;
+  int fd;
+
+  random_init (0);
+  random_bytes (bufs, sizeof bufs);
+
+  msg ("make %d directories, removing every other one", DIR_CNT);
+  quiet = true;
+  for (i = 0; i < DIR_CNT; i++)
+    {
+      snprintf (name, sizeof name, "d%zu", i);
+      CHECK (mkdir (name), "mkdir \"%s\"", name);
+      snprintf (name, sizeof name, "d%zu/f", i);
+      CHECK (create (name, 0), "create \"%s\"", name);
+      CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+      CHECK (write (fd, bufs[i], FILE_SIZE) == FILE_SIZE,
+             "write \"%s\"", name);
+      close (fd);
+
+      CHECK (create ("tmp", TMP_SIZE), "create \"tmp\"");
+      CHECK (remove ("tmp"), "remove \"tmp\"");
+
+      if (i % 2 == 1)
+        {
+          CHECK (remove (name), "remove \"%s\"", name);
+          snprintf (name, sizeof name, "d%zu", i);
+          CHECK (remove (name), "remove \"%s\"", name);
+        }
+    }
+  quiet = false;
+
+  msg ("check the files left");
+  quiet = true;
+  for (i = 0; i < DIR_CNT; i++)
+    {
+      snprintf (name, sizeof name, "d%zu/f", i);
+      if (i % 2 == 0)
+        check_file (name, bufs[i], FILE_SIZE);
+      else
+        CHECK (open (name) == -1, "open \"%s\"", name);
+    }
+  quiet = false;
+}
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(log-churn) begin
+(log-churn) make 40 directories, removing every other one
+(log-churn) check the files left
+(log-churn) end
+EOF
+pass;
@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+random_bytes (5000);
+check_archive ({"tmp" => {}, "disk" => [random_bytes (100)]});
+pass;
@@ -0,0 +1,74 @@
+/* Creates, grows, lists and removes files on the memory file
+   system mounted over "tmp", next to a file on disk.  Nothing
+   under "tmp" is left after a reboot. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BIG_SIZE 5000
+#define SPARSE_SIZE 9001
+static char big[BIG_SIZE];
+static char small[100];
+static char sparse[SPARSE_SIZE];
+
+/* Creates FILE_NAME and writes the SIZE bytes of BUF to it. */
+static void
+create_file (const char *file_name, const char *buf, size_t size)
+{
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, size) == (int) size, "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  char name[READDIR_MAX_LEN + 1];
+  int fd, cnt = 0;
+
+  random_init (0);
+  random_bytes (big, sizeof big);
+  random_bytes (small, sizeof small);
+
+  create_file ("tmp/big", big, sizeof big);
+  check_file ("tmp/big", big, sizeof big);
+
+  CHECK (mkdir ("tmp/d"), "mkdir \"tmp/d\"");
+  create_file ("tmp/d/small", small, sizeof small);
+  check_file ("tmp/d/small", small, sizeof small);
+
+  /* Only the last byte is written; the rest reads as zeros. */
+  sparse[SPARSE_SIZE - 1] = 'x';
+  CHECK (create ("tmp/sparse", 0), "create \"tmp/sparse\"");
+  CHECK ((fd = open ("tmp/sparse")) > 1, "open \"tmp/sparse\"");
+  seek (fd, SPARSE_SIZE - 1);
+  CHECK (write (fd, "x", 1) == 1, "write \"tmp/sparse\"");
+  msg ("close \"tmp/sparse\"");
+  close (fd);
+  check_file ("tmp/sparse", sparse, sizeof sparse);
+
+  create_file ("disk", small, sizeof small);
+  check_file ("disk", small, sizeof small);
+
+  CHECK ((fd = open ("tmp")) > 1, "open \"tmp\"");
+  while (readdir (fd, name))
+    {
+      if (strcmp (name, "big") && strcmp (name, "d")
+          && strcmp (name, "sparse"))
+        fail ("readdir listed unexpected \"%s\"", name);
+      cnt++;
+    }
+  CHECK (cnt == 3, "readdir \"tmp\" listed %d entries", cnt);
+  msg ("close \"tmp\"");
+  close (fd);
+
+  CHECK (remove ("tmp/big"), "remove \"tmp/big\"");
+  CHECK (open ("tmp/big") == -1, "open \"tmp/big\" after removal");
+}
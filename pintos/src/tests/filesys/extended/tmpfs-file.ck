@@ -0,0 +1,43 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(tmpfs-file) begin
+(tmpfs-file) create "tmp/big"
+(tmpfs-file) open "tmp/big"
+(tmpfs-file) write "tmp/big"
+(tmpfs-file) close "tmp/big"
+(tmpfs-file) open "tmp/big" for verification
+(tmpfs-file) verified contents of "tmp/big"
+(tmpfs-file) close "tmp/big"
+(tmpfs-file) mkdir "tmp/d"
+(tmpfs-file) create "tmp/d/small"
+(tmpfs-file) open "tmp/d/small"
+(tmpfs-file) write "tmp/d/small"
+(tmpfs-file) close "tmp/d/small"
+(tmpfs-file) open "tmp/d/small" for verification
+(tmpfs-file) verified contents of "tmp/d/small"
+(tmpfs-file) close "tmp/d/small"
+(tmpfs-file) create "tmp/sparse"
+(tmpfs-file) open "tmp/sparse"
+(tmpfs-file) write "tmp/sparse"
+(tmpfs-file) close "tmp/sparse"
+(tmpfs-file) open "tmp/sparse" for verification
+(tmpfs-file) verified contents of "tmp/sparse"
+(tmpfs-file) close "tmp/sparse"
+(tmpfs-file) create "disk"
+(tmpfs-file) open "disk"
+(tmpfs-file) write "disk"
+(tmpfs-file) close "disk"
+(tmpfs-file) open "disk" for verification
+(tmpfs-file) verified contents of "disk"
+(tmpfs-file) close "disk"
+(tmpfs-file) open "tmp"
+(tmpfs-file) readdir "tmp" listed 3 entries
+(tmpfs-file) close "tmp"
+(tmpfs-file) remove "tmp/big"
+(tmpfs-file) open "tmp/big" after removal
+(tmpfs-file) end
+EOF
+pass;
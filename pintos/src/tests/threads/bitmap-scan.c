@@ -0,0 +1,123 @@
+/* Checks bitmap_scan() and bitmap_scan_and_flip() on nearly full
+   bitmaps against a bit-by-bit search.  The free runs cross
+   element boundaries and summary boundaries, and sit among long
+   stretches of set bits that the scan skips a summary element at
+   a time. */
+
+#include <bitmap.h>
+#include <random.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+
+/* Not a multiple of any element size, and several summary
+   elements long. */
+#define BIT_CNT 4999
+
+/* Returns the first run of CNT bits in B at or after START that
+   are all VALUE, the slow way. */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i, j;
+
+  for (i = start; i + cnt <= bitmap_size (b); i++)
+    {
+      for (j = 0; j < cnt; j++)
+        if (bitmap_test (b, i + j) != value)
+          break;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Compares bitmap_scan() with slow_scan() on B for runs of both
+   values and of lengths around the element size, from starts
+   spread over B. */
+static void
+check_scans (const struct bitmap *b, const char *what)
+{
+  static const size_t cnts[] = {1, 2, 3, 7, 31, 32, 33, 63, 64, 65};
+  size_t start, i;
+  int value;
+
+  for (start = 0; start < BIT_CNT; start += 89)
+    for (i = 0; i < sizeof cnts / sizeof *cnts; i++)
+      for (value = 0; value <= 1; value++)
+        {
+          size_t expected = slow_scan (b, start, cnts[i], value);
+          size_t actual = bitmap_scan (b, start, cnts[i], value);
+          if (actual != expected)
+            fail ("%s: scan for %zu %s bits from %zu found %zu, not %zu",
+                  what, cnts[i], value ? "set" : "free", start,
+                  actual, expected);
+        }
+  msg ("%s: scans agree", what);
+}
+
+/* Takes runs of CNT free bits from B with bitmap_scan_and_flip()
+   until none is left, checking each against slow_scan(). */
+static void
+check_flips (struct bitmap *b, size_t cnt, const char *what)
+{
+  size_t expected, actual;
+
+  do
+    {
+      expected = slow_scan (b, 0, cnt, false);
+      actual = bitmap_scan_and_flip (b, 0, cnt, false);
+      if (actual != expected)
+        fail ("%s: took %zu free bits at %zu, not %zu",
+              what, cnt, actual, expected);
+      if (actual != BITMAP_ERROR && !bitmap_all (b, actual, cnt))
+        fail ("%s: bits at %zu were not set", what, actual);
+    }
+  while (actual != BITMAP_ERROR);
+  msg ("%s: flips agree", what);
+}
+
+void
+test_bitmap_scan (void)
+{
+  /* Runs crossing element and summary boundaries, and one that
+     ends with the bitmap. */
+  static const size_t runs[][2] =
+    {
+      {30, 4}, {60, 8}, {95, 2}, {1020, 10}, {2047, 66}, {4090, 10},
+      {4990, 9},
+    };
+  struct bitmap *b = bitmap_create (BIT_CNT);
+  size_t i;
+  int round;
+
+  if (b == NULL)
+    fail ("out of memory");
+
+  bitmap_set_all (b, true);
+  check_scans (b, "full");
+
+  for (i = 0; i < sizeof runs / sizeof *runs; i++)
+    bitmap_set_multiple (b, runs[i][0], runs[i][1], false);
+  check_scans (b, "boundary runs");
+  check_flips (b, 3, "boundary runs");
+
+  /* A few free bits and short runs at random places. */
+  random_init (0x5ca9);
+  for (round = 0; round < 8; round++)
+    {
+      bitmap_set_all (b, true);
+      for (i = 0; i < 40; i++)
+        {
+          size_t start = random_ulong () % BIT_CNT;
+          size_t cnt = random_ulong () % 40 + 1;
+          if (cnt > BIT_CNT - start)
+            cnt = BIT_CNT - start;
+          bitmap_set_multiple (b, start, cnt, false);
+        }
+      check_scans (b, "random runs");
+      check_flips (b, round + 1, "random runs");
+    }
+
+  bitmap_destroy (b);
+  pass ();
+}
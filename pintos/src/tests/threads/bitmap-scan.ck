@@ -0,0 +1,29 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(bitmap-scan) begin
+(bitmap-scan) full: scans agree
+(bitmap-scan) boundary runs: scans agree
+(bitmap-scan) boundary runs: flips agree
+(bitmap-scan) random runs: scans agree
+(bitmap-scan) random runs: flips agree
+(bitmap-scan) random runs: scans agree
+(bitmap-scan) random runs: flips agree
+(bitmap-scan) random runs: scans agree
+(bitmap-scan) random runs: flips agree
+(bitmap-scan) random runs: scans agree
+(bitmap-scan) random runs: flips agree
+(bitmap-scan) random runs: scans agree
+(bitmap-scan) random runs: flips agree
+(bitmap-scan) random runs: scans agree
+(bitmap-scan) random runs: flips agree
+(bitmap-scan) random runs: scans agree
+(bitmap-scan) random runs: flips agree
+(bitmap-scan) random runs: scans agree
+(bitmap-scan) random runs: flips agree
+(bitmap-scan) PASS
+(bitmap-scan) end
+EOF
+pass;
@@ -34,6 +34,7 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -53,6 +54,11 @@ static bool format_filesys;
    overriding the defaults. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
+
+/* -tmpfs: Directories to mount memory file systems over. */
+#define TMPFS_MAX 8
+static const char *tmpfs_names[TMPFS_MAX];
+static size_t tmpfs_cnt;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
@@ -130,12 +136,12 @@ pintos_init (void)
   locate_block_devices ();
   filesys_init (format_filesys);
   thread_init_dir ();
+  for (size_t i = 0; i < tmpfs_cnt; i++)
+    if (!filesys_mount_tmpfs (tmpfs_names[i]))
+      PANIC ("cannot mount tmpfs on `%s'", tmpfs_names[i]);
 #endif
 
 	/* yveh */
-#ifdef USERPROG
-	lock_init(&filesys_lock);
-#endif
 #ifdef VM
 	frame_init();
 	swap_init();
@@ -289,6 +295,31 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        {
+          if (value != NULL && !strcmp (value, "clock"))
+            cache_replacement = CACHE_CLOCK;
+          else if (value != NULL && !strcmp (value, "2q"))
+            cache_replacement = CACHE_2Q;
+          else
+            PANIC ("unknown cache policy `%s' (use -h for help)",
+                   value != NULL ? value : "");
+        }
+      else if (!strcmp (name, "-blocksize"))
+        {
+          filesys_block_size = value != NULL ? atoi (value) : 0;
+          if (filesys_block_size < BLOCK_SECTOR_SIZE
+              || filesys_block_size > PGSIZE
+              || (filesys_block_size & (filesys_block_size - 1)) != 0)
+            PANIC ("bad block size `%s' (use -h for help)",
+                   value != NULL ? value : "");
+        }
+      else if (!strcmp (name, "-tmpfs"))
+        {
+          if (value == NULL || tmpfs_cnt >= TMPFS_MAX)
+            PANIC ("bad or too many -tmpfs options (use -h for help)");
+          tmpfs_names[tmpfs_cnt++] = value;
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -415,6 +446,9 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=POLICY      Use buffer cache POLICY: clock (default) or 2q.\n"
+          "  -blocksize=BYTES   Format with BYTES per block, 512 (default) to 4096.\n"
+          "  -tmpfs=DIR         Mount a memory file system over DIR.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
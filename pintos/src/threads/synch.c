@@ -399,9 +399,9 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
   
   sema_init (&waiter.semaphore, 0);
+  waiter.pthread = thread_current();
   list_push_back (&cond->waiters, &waiter.elem);
   lock_release (lock);
-  waiter.pthread = thread_current();
   sema_down (&waiter.semaphore);
   lock_acquire (lock);
 }
@@ -460,3 +460,84 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RW as an unheld readers-writer lock. */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  cond_init (&rw->changed);
+  rw->readers = 0;
+  rw->writer = NULL;
+  rw->waiting_writers = 0;
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   waits for it, so that a stream of readers cannot starve
+   writers.  Readers do not exclude one another, but a thread must
+   not acquire RW for reading twice. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+  while (rw->writer != NULL || rw->waiting_writers > 0)
+    cond_wait (&rw->changed, &rw->lock);
+  rw->readers++;
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for reading. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+  ASSERT (rw->readers > 0);
+  if (--rw->readers == 0)
+    cond_broadcast (&rw->changed, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no reader or writer
+   holds it. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (!rwlock_write_held_by_current_thread (rw));
+
+  lock_acquire (&rw->lock);
+  rw->waiting_writers++;
+  while (rw->writer != NULL || rw->readers > 0)
+    cond_wait (&rw->changed, &rw->lock);
+  rw->waiting_writers--;
+  rw->writer = thread_current ();
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for writing. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (rwlock_write_held_by_current_thread (rw));
+
+  lock_acquire (&rw->lock);
+  rw->writer = NULL;
+  cond_broadcast (&rw->changed, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing. */
+bool
+rwlock_write_held_by_current_thread (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return rw->writer == thread_current ();
+}
@@ -46,6 +46,26 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock.
+   Any number of readers or a single writer may hold it.  It is
+   not recursive: a thread must not acquire it again, in either
+   mode, while holding it. */
+struct rwlock
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct condition changed;   /* Signaled when the lock is released. */
+    int readers;                /* Number of readers holding the lock. */
+    struct thread *writer;      /* Writer holding the lock, if any. */
+    int waiting_writers;        /* Writers waiting for the lock. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_write_held_by_current_thread (const struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -27,10 +27,6 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
-#ifdef USERPROG
-struct lock filesys_lock;
-#endif
-
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -151,6 +147,11 @@ struct thread
 #endif
 #ifdef FILESYS
    struct dir *dir;
+   int log_depth;                      /* Nesting of log_begin() calls. */
+   size_t log_blocks;                  /* Blocks its log operation
+                                          added to the transaction. */
+   size_t reserve_spent;               /* Reserved free sectors this
+                                          thread may allocate. */
 #endif
 
     /* Owned by thread.c. */
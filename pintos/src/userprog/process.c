@@ -191,10 +191,6 @@ process_exit (void)
 
   printf("%s: exit(%d)\n", cur->name, cur->ret_status);
 
-  /* if thread_exit but not release filesys_lock */
-  if (!lock_held_by_current_thread(&filesys_lock))
-    lock_acquire(&filesys_lock);
-
 	/* Close files */
 	file_close(cur->self);
 
@@ -206,8 +202,6 @@ process_exit (void)
 		free(entry);
 	}
 
-	lock_release(&filesys_lock);
-
 	/* delete mapping list */
 	struct mapping_t *mp_e;
 	while (!list_empty(&cur->mappings)) {
@@ -347,8 +341,6 @@ load (const char *file_name, void (**eip) (void), void **esp)
   bool success = false;
   int i;
 
-	lock_acquire(&filesys_lock);
-
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
@@ -456,7 +448,6 @@ load (const char *file_name, void (**eip) (void), void **esp)
  done:
   /* We arrive here whether the load is successful or not. */
 //  file_close (file);
-	lock_release(&filesys_lock);
   return success;
 }
 
@@ -537,7 +528,6 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
       /* Get a page of memory. */
 #ifdef VM
-      lock_release(&filesys_lock);
 	    struct page *kpage = page_alloc(upage, writable);
       if (kpage == NULL)
         return false;
@@ -553,7 +543,6 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 //        return false;
 //      }
 //      memset(kpage->frame->base + page_read_bytes, 0, page_zero_bytes);
-		lock_acquire(&filesys_lock);
 #else
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
@@ -589,7 +578,6 @@ setup_stack (void **esp)
 {
   bool success = false;
 #ifdef VM
-  lock_release(&filesys_lock);
   struct page *kpage = page_alloc(((uint8_t *) PHYS_BASE) - PGSIZE, true);
   if (kpage != NULL) {
     success = frame_alloc(kpage);
@@ -601,7 +589,6 @@ setup_stack (void **esp)
 			page_free(kpage);
 		}
   }
-  lock_acquire(&filesys_lock);
 #else
 	uint8_t *kpage;
 
@@ -836,10 +823,6 @@ process_exit (void)
 
   printf("%s: exit(%d)\n", cur->name, cur->ret_status);
 
-  /* ??? */
-	if (!lock_held_by_current_thread(&filesys_lock))
-		lock_acquire(&filesys_lock);
-
 	/* Close files */
 	file_close(cur->self);
 
@@ -851,8 +834,6 @@ process_exit (void)
 		free(entry);
 	}
 
-	lock_release(&filesys_lock);
-
 
 	/* delete children list */
 	while (!list_empty(&cur->children)) {
@@ -977,8 +958,6 @@ load (const char *file_name, void (**eip) (void), void **esp)
   bool success = false;
   int i;
 
-	lock_acquire(&filesys_lock);
-
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
@@ -1079,7 +1058,6 @@ load (const char *file_name, void (**eip) (void), void **esp)
  done:
   /* We arrive here whether the load is successful or not. */
 //  file_close (file);
-	lock_release(&filesys_lock);
   return success;
 }
 
@@ -10,6 +10,7 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/directory.h"
+#include "filesys/cache.h"
 #include "lib/user/syscall.h"
 #include "userprog/pagedir.h"
 #include "string.h"
@@ -39,6 +40,7 @@ static bool syscall_mkdir (struct intr_frame *f);
 static bool syscall_readdir (struct intr_frame *f);
 static bool syscall_isdir (struct intr_frame *f);
 static int syscall_inumber (struct intr_frame *f);
+static bool syscall_cache_stats (struct intr_frame *f);
 
 
 void
@@ -96,6 +98,18 @@ is_valid_addr(void *addr) {
 #endif
 }
 
+/* Returns true if the user may write to ADDR, which
+   is_valid_addr() has accepted. */
+static bool
+is_writable_addr(void *addr) {
+#ifdef VM
+	struct page *p = page_for_addr(addr);
+	return p != NULL && p->writable;
+#else
+	return pagedir_is_writable(thread_current()->pagedir, addr);
+#endif
+}
+
 static void*
 pop_stack(int *esp, void *dst, int offset) {
   *((int *)dst) = *((int *)get_paddr(esp + offset));
@@ -133,6 +147,7 @@ syscall_handler (struct intr_frame *f)
     case SYS_READDIR: f->eax = syscall_readdir(f); break;
     case SYS_ISDIR: f->eax = syscall_isdir(f); break;
     case SYS_INUMBER: f->eax = syscall_inumber(f); break;
+    case SYS_CACHE_STATS: f->eax = syscall_cache_stats(f); break;
 #endif
 
     default:
@@ -171,8 +186,6 @@ syscall_exec(struct intr_frame *f) {
   if (!is_valid_addr(file_name)) {
     return -1;
   }
-  lock_acquire(&filesys_lock);
-
   char *fn_cp = malloc(strlen(file_name) + 1);
   char *token, *save_ptr;
   strlcpy(fn_cp, file_name, strlen(file_name) + 1);
@@ -181,12 +194,10 @@ syscall_exec(struct intr_frame *f) {
   struct file *fi = filesys_open(token);
 
   if (fi == NULL) {
-    lock_release(&filesys_lock);
     return -1;
   }
   else {
     file_close(fi);
-    lock_release(&filesys_lock);
     return process_execute(file_name);
   }
 }
@@ -209,9 +220,7 @@ syscall_create(struct intr_frame *f) {
     return false;
 
   bool ret;
-  lock_acquire(&filesys_lock);
   ret = filesys_create(file_name, size);
-  lock_release(&filesys_lock);
   return ret;
 }
 
@@ -223,9 +232,7 @@ syscall_remove(struct intr_frame *f) {
     return false;
 
   bool ret;
-  lock_acquire(&filesys_lock);
   ret = filesys_remove(file_name);
-  lock_release(&filesys_lock);
   return ret;
 }
 
@@ -238,9 +245,7 @@ syscall_open(struct intr_frame *f) {
 		return -1;
 	}
 
-	lock_acquire(&filesys_lock);
 	struct file *fi = filesys_open(file_name);
-	lock_release(&filesys_lock);
 	if (fi == NULL) {
 		return -1;
 	}
@@ -274,9 +279,7 @@ static int
 syscall_filesize(struct intr_frame *f) {
   int fd;
   pop_stack(f->esp, &fd, 1);
-  lock_acquire(&filesys_lock);
   int ret = file_length(get_file_by_fd(&thread_current()->files, fd)->ptr);
-  lock_release(&filesys_lock);
   return ret;
 }
 
@@ -314,9 +317,7 @@ syscall_read(struct intr_frame *f) {
 			ofs = read_size;
 		}
 		else {
-			lock_acquire(&filesys_lock);
 			ofs = file_read(fd_e->ptr, buffer, read_size);
-			lock_release(&filesys_lock);
 		}
 		if (ofs == 0)
 			break;
@@ -363,9 +364,7 @@ syscall_write(struct intr_frame *f) {
 			ofs = write_size;
 		}
 		else {
-			lock_acquire(&filesys_lock);
 			ofs = file_write(fd_e->ptr, buffer, write_size);
-			lock_release(&filesys_lock);
 		}
 		if (ofs == 0)
 			break;
@@ -383,9 +382,7 @@ syscall_seek(struct intr_frame *f) {
 	pop_stack(f->esp, &pos, 2);
 	pop_stack(f->esp, &fd, 1);
 
-  lock_acquire(&filesys_lock);
   file_seek(get_file_by_fd(&thread_current()->files, fd)->ptr, pos);
-  lock_release(&filesys_lock);
 }
 
 static int
@@ -393,7 +390,6 @@ syscall_tell(struct intr_frame *f) {
   int fd;
   pop_stack(f->esp, &fd, 1);
 
-  lock_acquire(&filesys_lock);
   struct fd_t* fd_e = get_file_by_fd(&thread_current()->files, fd);
   int ret;
   if (fd_e == NULL || inode_is_dir (file_get_inode(fd_e->ptr))) {
@@ -401,7 +397,6 @@ syscall_tell(struct intr_frame *f) {
   } else {
     ret = file_tell(fd_e->ptr);
   }
-  lock_release(&filesys_lock);
 
   return ret;
 }
@@ -412,7 +407,6 @@ syscall_close(struct intr_frame *f) {
   pop_stack(f->esp, &fd, 1);
   struct fd_t *entry = get_file_by_fd(&thread_current()->files, fd);
   if (entry != NULL) {
-    lock_acquire(&filesys_lock);
 #ifdef FILESYS
     if (inode_is_dir (file_get_inode(entry->ptr)))
       dir_close (entry->opened_dir);
@@ -420,7 +414,6 @@ syscall_close(struct intr_frame *f) {
     file_close(entry->ptr);
     list_remove(&entry->elem);
     free(entry);
-    lock_release(&filesys_lock);
   }
 }
 
@@ -510,6 +503,24 @@ syscall_inumber (struct intr_frame *f) {
     return inode_get_inumber (file_get_inode (fd_e->ptr));
   return -1;
 }
+
+static bool
+syscall_cache_stats (struct intr_frame *f) {
+  struct cache_stats *ustats;
+  struct cache_stats kstats;
+  pop_stack (f->esp, &ustats, 1);
+  if (ustats == NULL)
+    return false;
+  if (!is_valid_addr (ustats)
+      || !is_valid_addr ((char *) ustats + sizeof *ustats - 1))
+    return false;
+  if (!is_writable_addr (ustats)
+      || !is_writable_addr ((char *) ustats + sizeof *ustats - 1))
+    syscall_exit_helper (-1);
+  cache_get_stats (&kstats);
+  memcpy (ustats, &kstats, sizeof kstats);
+  return true;
+}
 #endif
 
 #ifdef VM
@@ -532,16 +543,12 @@ syscall_mmap(struct intr_frame *f) {
 	struct mapping_t *mp_e = malloc(sizeof(*mp_e));
 	struct thread *t = thread_current();
 	mp_e->id = t->mapping_cnt++;
-	lock_acquire(&filesys_lock);
 	mp_e->ptr = file_reopen(entry->ptr);
-	lock_release(&filesys_lock);
 	mp_e->page_cnt = 0;
 	mp_e->base = addr;
 
 	int ofs = 0;
-	lock_acquire(&filesys_lock);
 	int size = file_length (mp_e->ptr);
-	lock_release(&filesys_lock);
 	while (size > 0) {
 		struct page *p = page_alloc((uint8_t *)addr + ofs, true);
 		if (p == NULL) {
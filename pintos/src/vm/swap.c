@@ -9,6 +9,15 @@ static struct bitmap *swap_bitmap;
 
 #define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
 
+/* Points BUFS at the PAGE_SECTORS sector-sized pieces of PAGE. */
+static void
+page_sectors(void *page, void *bufs[PAGE_SECTORS]) {
+	size_t i;
+
+	for (i = 0; i < PAGE_SECTORS; i++)
+		bufs[i] = (uint8_t *) page + i * BLOCK_SECTOR_SIZE;
+}
+
 void
 swap_init() {
 	swap_device = block_get_role (BLOCK_SWAP);
@@ -21,10 +30,10 @@ swap_init() {
 
 void
 swap_in(struct page *p) {
-	size_t i;
+	void *bufs[PAGE_SECTORS];
 
-	for (i = 0; i < PAGE_SECTORS; i++)
-		block_read(swap_device, p->sector + i, p->frame->base + i * BLOCK_SECTOR_SIZE);
+	page_sectors(p->frame->base, bufs);
+	block_read_multi(swap_device, p->sector, PAGE_SECTORS, bufs);
 	bitmap_reset(swap_bitmap, p->sector / PAGE_SECTORS);
 	p->sector = -1;
 }
@@ -32,7 +41,7 @@ swap_in(struct page *p) {
 bool
 swap_out(struct page *p) {
 	size_t slot;
-	size_t i;
+	void *bufs[PAGE_SECTORS];
 
 	lock_acquire (&swap_lock);
 	slot = bitmap_scan_and_flip(swap_bitmap, 0, 1, false);
@@ -42,8 +51,8 @@ swap_out(struct page *p) {
 
 	p->sector = slot * PAGE_SECTORS;
 
-	for (i = 0; i < PAGE_SECTORS; i++)
-		block_write(swap_device, p->sector + i, (uint8_t *) p->frame->base + i * BLOCK_SECTOR_SIZE);
+	page_sectors(p->frame->base, bufs);
+	block_write_multi(swap_device, p->sector, PAGE_SECTORS, bufs);
 
 	p->private = false;
 	p->file = NULL;